@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# load time, memory and lookup latency against dictionary size
+# on synthetic dictionaries, run from the build directory
+#
+# usage: bench.sh [<kanji> ...]
+
+DIR=$(dirname "$0")
+SIZES=${*:-"3000 13000 40000 80000"}
+DICT=$(mktemp) || exit 1
+
+trap 'rm -f "$DICT"' EXIT
+
+printf "%8s %9s %9s %8s %8s %8s %8s  %s\n" \
+    kanji load_ms rss_kb avg_us p50_us p99_us max_us "p99 # max . (20us)"
+
+for n in $SIZES; do
+    "$DIR/rtkgen" "$n" >"$DICT" || exit 1
+    "$DIR/rtkbench" "$DICT" | awk '{
+        bar = ""
+        for(x=0; x<$6/20 && x<50; x++)
+            bar = bar "#"
+        for(; x<$7/20 && x<50; x++)
+            bar = bar "."
+        printf "%8d %9.1f %9d %8.1f %8.1f %8.1f %8.1f  %s\n", $1, $2, $3, $4, $5, $6, $7, bar
+    }'
+done
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "client.h"
+
+#define SOCKET_NAME "ibus-rtk.sock"
+
+
+const char* rtk_client_socket()
+{
+    static char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    
+    // per user socket in the runtime directory if there is one
+    if(dir && *dir)
+        snprintf(path, sizeof(path), "%s/%s", dir, SOCKET_NAME);
+    else
+        snprintf(path, sizeof(path), "/tmp/%s.%u", SOCKET_NAME, (unsigned int)getuid());
+    
+    return path;
+}
+
+int rtk_client_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+    
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return -1;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+int rtk_client_io(int fd, char *buf, size_t len, int out)
+{
+    ssize_t ret;
+    
+    while(len)
+    {
+        ret = out ? write(fd, buf, len) : read(fd, buf, len);
+        if(ret == -1 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+        {
+            if(!ret)
+                errno = ECONNRESET;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    
+    return 0;
+}
+
+int rtk_client_lookup(int fd, int argc, char **argv, char **response, unsigned int *len)
+{
+    uint32_t size;
+    char *frame;
+    int x, pos;
+    
+    for(x=0, size=0; x<argc; x++)
+        size += strlen(argv[x])+1;
+    if(size > RTK_FRAME_MAX)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    frame = malloc(4+size);
+    for(x=0, pos=4; x<argc; x++)
+    {
+        strcpy(frame+pos, argv[x]);
+        pos += strlen(argv[x]);
+        frame[pos++] = '\n';
+    }
+    size = htonl(size ? size-1 : 0);
+    memcpy(frame, &size, 4);
+    
+    if(rtk_client_io(fd, frame, pos > 4 ? pos-1 : 4, 1) == -1)
+    {
+        free(frame);
+        return -1;
+    }
+    free(frame);
+    
+    if(rtk_client_io(fd, (char*)&size, 4, 0) == -1)
+        return -1;
+    
+    *len = ntohl(size);
+    *response = malloc(*len+1);
+    if(rtk_client_io(fd, *response, *len, 0) == -1)
+    {
+        free(*response);
+        *response = 0;
+        return -1;
+    }
+    (*response)[*len] = 0;
+    
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __CLIENT_H__
+#define __CLIENT_H__
+
+// frames in both directions are a 4 byte length in network byte order
+// followed by that many bytes
+//
+// request:  primitives separated by '\n'
+// response: one line per result, fields separated by '\t'
+//           found     <number> <kanji> <meaning>
+//           partial   <number> <kanji> <meaning> <primitives found>
+//           notfound  <primitive>
+
+#define RTK_FRAME_MAX 65536
+
+const char* rtk_client_socket();
+int rtk_client_connect(const char *path);
+int rtk_client_lookup(int fd, int argc, char **argv, char **response, unsigned int *len);
+
+#endif
@@ -23,24 +23,57 @@
  * THE SOFTWARE.
  */
 
+#include <string.h>
+
 #include "engine.h"
 #include "lookup.h"
+#include "history.h"
+
+#define LOOKUP_PAGE_SIZE 10
+#define LOOKUP_AHEAD 5
+#define SEGMENT_ALTERNATIVES 4
+#define COMPLETE_MAX 5
+#define CORRECTION_LEN (RTK_WORD_LEN+3)
+#define DECOMPOSE_LEN 256
+#define PARTIAL_KEY 0x80000000
+
+#define COLOR_FOUND 0x00ff00
+#define COLOR_NOT_FOUND 0xff0000
 
 #define is_alpha(c) (((c) >= IBUS_a && (c) <= IBUS_z) || ((c) >= IBUS_A && (c) <= IBUS_Z))
+#define is_digit(c) ((c) >= IBUS_0 && (c) <= IBUS_9)
 #define primitive_current(n) (g_array_index(rtk->primitives, GString*, rtk->primitive_current+(n)))
 
-extern gchar *dict;
+extern gchar **dicts;
+extern gboolean verbose, segment, fuzzy, explain;
 
 typedef struct _IBusRTKEngine IBusRTKEngine;
 typedef struct _IBusRTKEngineClass IBusRTKEngineClass;
 
+struct rtkspan
+{
+    guint start, len;
+};
+
 struct _IBusRTKEngine
 {
     IBusEngine parent;
     IBusLookupTable *table;
-    GString *preedit, *prekanji;
+    GString *preedit, *prekanji, *aux, *corrected, *query;
+    IBusText *preedit_text, *text, *aux_text;
+    GPtrArray *attrs;
     gint cursor, primitive_count, primitive_current, primitive_cursor;
+    struct rtkinput *input;
+    struct rtkspan *spans;
+    gchar *corrections;
+    guint input_count, input_cap;
+    GArray *segments, *choice;
+    struct rtkcontext *context;
     struct rtkresult *lookup;
+    guint lookup_count, ranked, generation;
+    guint64 query_hash;
+    GArray *scores;
+    GHashTable *candidates;
     GArray *primitives;
 };
 
@@ -50,11 +83,18 @@ struct _IBusRTKEngineClass
 };
 
 
+// the index is shared by all engines, reloaded only while none
+// has a lookup open, candidates cached before are dropped after
+static guint lookups_open = 0;
+static guint generation = 0;
+
+
 static void ibus_rtk_engine_class_init(IBusRTKEngineClass *klass);
 static void ibus_rtk_engine_init(IBusRTKEngine *rtk);
 static void ibus_rtk_engine_destroy(IBusRTKEngine *rtk);
 static void ibus_rtk_engine_focus_in(IBusEngine *engine);
 static gboolean ibus_rtk_engine_process_key_event(IBusEngine *engine, guint keyval, guint keycode, guint modifiers);
+static guint ibus_rtk_engine_lookup_result(IBusRTKEngine *rtk, struct rtkresult *result);
 
 
 G_DEFINE_TYPE(IBusRTKEngine, ibus_rtk_engine, IBUS_TYPE_ENGINE)
@@ -71,6 +111,17 @@ static void ibus_rtk_engine_primitive_free(gpointer data)
     g_string_free(*(GString**)data, TRUE);
 }
 
+static IBusText* ibus_rtk_engine_text_new()
+{
+    IBusText *text;
+    
+    // texts are kept and repointed to the current buffer on every update
+    text = ibus_text_new_from_static_string("");
+    g_object_ref_sink(text);
+    
+    return text;
+}
+
 static void ibus_rtk_engine_init(IBusRTKEngine *rtk)
 {
     GString *str;
@@ -78,13 +129,39 @@ static void ibus_rtk_engine_init(IBusRTKEngine *rtk)
     const char *labels[] = {"一", "二", "三", "四", "五", "六", "七", "八", "九", "十", 0};
     char **label = (char**)labels;
     
-    rtk->preedit = g_string_new("");
-    rtk->prekanji = g_string_new("");
+    rtk->preedit = g_string_sized_new(64);
+    rtk->prekanji = g_string_sized_new(16);
+    rtk->aux = g_string_sized_new(16);
+    rtk->corrected = g_string_new("");
+    rtk->query = g_string_sized_new(64);
     rtk->cursor = 0;
     
-    rtk->table = ibus_lookup_table_new(10, 0, TRUE, TRUE);
+    rtk->preedit_text = ibus_rtk_engine_text_new();
+    rtk->preedit_text->attrs = ibus_attr_list_new();
+    g_object_ref_sink(rtk->preedit_text->attrs);
+    rtk->text = ibus_rtk_engine_text_new();
+    rtk->aux_text = ibus_rtk_engine_text_new();
+    rtk->attrs = g_ptr_array_new_with_free_func(g_object_unref);
+    
+    rtk->input = 0;
+    rtk->spans = 0;
+    rtk->corrections = 0;
+    rtk->input_count = 0;
+    rtk->input_cap = 0;
+    rtk->segments = g_array_new(FALSE, FALSE, sizeof(struct rtksegmentation));
+    rtk->choice = g_array_new(FALSE, TRUE, sizeof(guint));
+    
+    rtk->table = ibus_lookup_table_new(LOOKUP_PAGE_SIZE, 0, TRUE, TRUE);
     g_object_ref_sink(rtk->table);
     
+    rtk->lookup = 0;
+    rtk->lookup_count = 0;
+    rtk->generation = generation;
+    rtk->query_hash = 0;
+    rtk->ranked = 0;
+    rtk->scores = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    rtk->candidates = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    
     while(*label)
     {
         text = ibus_text_new_from_printf("%s", *(label++));
@@ -99,7 +176,10 @@ static void ibus_rtk_engine_init(IBusRTKEngine *rtk)
     rtk->primitive_cursor = 0;
     g_array_set_clear_func(rtk->primitives, ibus_rtk_engine_primitive_free);
     
-    rtk_lookup_init(dict);
+    // results live in the context of the engine showing them
+    rtk_lookup_init(g_strv_length(dicts), (const char**)dicts);
+    rtk->context = rtk_context_new();
+    rtk_history_init();
 }
 
 static void ibus_rtk_engine_destroy(IBusRTKEngine *rtk)
@@ -108,14 +188,78 @@ static void ibus_rtk_engine_destroy(IBusRTKEngine *rtk)
         g_string_free(rtk->preedit, TRUE);
     if(rtk->prekanji)
         g_string_free(rtk->prekanji, TRUE);
+    if(rtk->aux)
+        g_string_free(rtk->aux, TRUE);
+    if(rtk->corrected)
+        g_string_free(rtk->corrected, TRUE);
+    if(rtk->query)
+        g_string_free(rtk->query, TRUE);
+    if(rtk->preedit_text)
+        g_object_unref(rtk->preedit_text);
+    if(rtk->text)
+        g_object_unref(rtk->text);
+    if(rtk->aux_text)
+        g_object_unref(rtk->aux_text);
+    if(rtk->attrs)
+        g_ptr_array_free(rtk->attrs, TRUE);
+    g_free(rtk->input);
+    g_free(rtk->spans);
+    g_free(rtk->corrections);
+    if(rtk->segments)
+        g_array_free(rtk->segments, TRUE);
+    if(rtk->choice)
+        g_array_free(rtk->choice, TRUE);
     if(rtk->table)
         g_object_unref(rtk->table);
+    if(rtk->scores)
+        g_array_free(rtk->scores, TRUE);
+    if(rtk->candidates)
+        g_hash_table_destroy(rtk->candidates);
     if(rtk->primitives)
         g_array_free(rtk->primitives, TRUE);
+    if(rtk->lookup)
+        lookups_open--;
+    rtk->lookup = 0;
+    rtk_context_free(rtk->context);
+    rtk->context = 0;
     rtk_lookup_free();
+    rtk_history_free();
     ((IBusObjectClass*)ibus_rtk_engine_parent_class)->destroy((IBusObject*)rtk);
 }
 
+static void ibus_rtk_engine_primitive_insert(IBusRTKEngine *rtk, guint pos)
+{
+    GString **prim, *str;
+    
+    // strings beyond primitive_count are kept as spares
+    if(rtk->primitive_count == rtk->primitives->len)
+    {
+        str = g_string_new("");
+        g_array_append_val(rtk->primitives, str);
+    }
+    
+    prim = &g_array_index(rtk->primitives, GString*, 0);
+    str = prim[rtk->primitive_count];
+    memmove(prim+pos+1, prim+pos, (rtk->primitive_count-pos)*sizeof(GString*));
+    prim[pos] = str;
+    rtk->primitive_count++;
+}
+
+static void ibus_rtk_engine_primitive_remove(IBusRTKEngine *rtk, guint pos, guint count)
+{
+    GString **prim, *str;
+    
+    // move removed strings behind the used ones to reuse them
+    prim = &g_array_index(rtk->primitives, GString*, 0);
+    while(count--)
+    {
+        str = prim[pos];
+        memmove(prim+pos, prim+pos+1, (rtk->primitive_count-pos-1)*sizeof(GString*));
+        g_string_truncate(str, 0);
+        prim[--rtk->primitive_count] = str;
+    }
+}
+
 static void ibus_rtk_engine_reset(IBusRTKEngine *rtk)
 {
     guint x;
@@ -124,117 +268,478 @@ static void ibus_rtk_engine_reset(IBusRTKEngine *rtk)
     g_string_assign(rtk->prekanji, "");
     rtk->cursor = 0;
     
-    if(rtk->primitive_count > 1)
-        g_array_remove_range(rtk->primitives, 1, rtk->primitive_count-1);
+    for(x=0; x<rtk->primitive_count; x++)
+        g_string_truncate(g_array_index(rtk->primitives, GString*, x), 0);
     rtk->primitive_count = 1;
     rtk->primitive_current = 0;
     rtk->primitive_cursor = 0;
-    g_string_assign(primitive_current(0), "");
+    
+    ibus_rtk_engine_lookup_result(rtk, 0);
     
     ibus_engine_hide_preedit_text((IBusEngine*)rtk);
     ibus_engine_hide_auxiliary_text((IBusEngine*)rtk);
     ibus_engine_hide_lookup_table((IBusEngine*)rtk);
 }
 
-static void ibus_rtk_engine_update_preedit(IBusRTKEngine *rtk, struct rtkinput *input)
+static IBusText* ibus_rtk_engine_text(IBusText *text, GString *str)
 {
-    IBusText *text;
-    guint x, pos, len;
+    // the buffer may have moved since the last update
+    text->text = str->str;
+    return text;
+}
+
+static void ibus_rtk_engine_attr(IBusRTKEngine *rtk, guint type, guint value, guint start, guint end)
+{
+    IBusAttrList *attrs = rtk->preedit_text->attrs;
+    IBusAttribute *attr;
     
-    text = ibus_text_new_from_static_string(rtk->preedit->str);
-    text->attrs = ibus_attr_list_new();
+    // attributes are pooled, the n-th attribute of the list is the n-th of the pool
+    if(attrs->attributes->len == rtk->attrs->len)
+    {
+        attr = ibus_attribute_new(type, value, start, end);
+        g_object_ref_sink(attr);
+        g_ptr_array_add(rtk->attrs, attr);
+    }
+    else
+    {
+        attr = g_ptr_array_index(rtk->attrs, attrs->attributes->len);
+        attr->type = type;
+        attr->value = value;
+        attr->start_index = start;
+        attr->end_index = end;
+    }
+    
+    ibus_attr_list_append(attrs, attr);
+}
+
+static void ibus_rtk_engine_attr_clear(IBusRTKEngine *rtk)
+{
+    GArray *attributes = rtk->preedit_text->attrs->attributes;
+    guint x;
+    
+    for(x=0; x<attributes->len; x++)
+        g_object_unref(g_array_index(attributes, IBusAttribute*, x));
+    g_array_set_size(attributes, 0);
+}
+
+static void ibus_rtk_engine_input_add(IBusRTKEngine *rtk, char *primitive, guint start, guint len)
+{
+    if(rtk->input_count == rtk->input_cap)
+    {
+        rtk->input_cap = rtk->input_cap ? 2*rtk->input_cap : 4;
+        rtk->input = g_renew(struct rtkinput, rtk->input, rtk->input_cap);
+        rtk->spans = g_renew(struct rtkspan, rtk->spans, rtk->input_cap);
+        rtk->corrections = g_renew(gchar, rtk->corrections, rtk->input_cap*CORRECTION_LEN);
+    }
+    
+    rtk->input[rtk->input_count].primitive = primitive;
+    rtk->spans[rtk->input_count].start = start;
+    rtk->spans[rtk->input_count].len = len;
+    rtk->input_count++;
+}
+
+static void ibus_rtk_engine_input(IBusRTKEngine *rtk, gboolean choose)
+{
+    struct rtksegmentation seg[SEGMENT_ALTERNATIVES], *chosen;
+    GString *str;
+    guint x, y, pos, choice;
+    
+    rtk->input_count = 0;
+    if(segment)
+        g_array_set_size(rtk->segments, rtk->primitive_count);
     
     for(x=0, pos=0; x<rtk->primitive_count; x++)
     {
-        len = g_array_index(rtk->primitives, GString*, x)->len;
-        ibus_attr_list_append(text->attrs,
-            ibus_attr_underline_new(IBUS_ATTR_UNDERLINE_SINGLE, pos, pos+len));
+        str = g_array_index(rtk->primitives, GString*, x);
+        choice = choose ? g_array_index(rtk->choice, guint, x) : 0;
+        
+        // split unspaced primitives into the words of the chosen segmentation
+        if(segment && rtk_segment(str->str, seg, choice+1) > choice)
+        {
+            chosen = &g_array_index(rtk->segments, struct rtksegmentation, x);
+            *chosen = seg[choice];
+            for(y=0; y<chosen->count; y++)
+                ibus_rtk_engine_input_add(rtk, rtk_segment_primitive(chosen, y),
+                    pos+chosen->segment[y].start, chosen->segment[y].len);
+        }
+        else
+            ibus_rtk_engine_input_add(rtk, str->str, pos, str->len);
+        
+        pos += str->len+1;
+    }
+}
+
+static void ibus_rtk_engine_complete(IBusRTKEngine *rtk)
+{
+    GString *str = primitive_current(0);
+    const int *words = 0;
+    char more[16];
+    int x, first, count = 0;
+    
+    // patterns list the words matching them instead
+    if(str->len && (count = rtk_vocab_pattern(str->str, &words)) == -1)
+    {
+        words = 0;
+        count = rtk_vocab_complete(str->str, &first);
+    }
+    
+    if(!str->len || !count)
+    {
+        ibus_engine_hide_auxiliary_text((IBusEngine*)rtk);
+        return;
+    }
+    
+    // list the first completions of the primitive under the cursor
+    g_string_truncate(rtk->aux, 0);
+    for(x=0; x<count && x<COMPLETE_MAX; x++)
+    {
+        if(x)
+            g_string_append(rtk->aux, ", ");
+        g_string_append(rtk->aux, rtk_vocab_word(words ? words[x] : first+x));
+    }
+    if(count > COMPLETE_MAX)
+    {
+        g_snprintf(more, sizeof(more), " (+%i)", count-COMPLETE_MAX);
+        g_string_append(rtk->aux, more);
+    }
+    
+    ibus_engine_update_auxiliary_text((IBusEngine*)rtk,
+        ibus_rtk_engine_text(rtk->aux_text, rtk->aux), TRUE);
+}
+
+static void ibus_rtk_engine_update_preedit(IBusRTKEngine *rtk, struct rtkinput *input)
+{
+    struct rtkspan *span;
+    int first;
+    guint x;
+    
+    // without lookup underline the preferred segmentation
+    if(!input)
+        ibus_rtk_engine_input(rtk, FALSE);
+    
+    ibus_rtk_engine_attr_clear(rtk);
+    
+    for(x=0; x<rtk->input_count; x++)
+    {
+        span = &rtk->spans[x];
+        ibus_rtk_engine_attr(rtk, IBUS_ATTR_TYPE_UNDERLINE,
+            IBUS_ATTR_UNDERLINE_SINGLE, span->start, span->start+span->len);
         if(input)
         {
             if(!input[x].found)
-                ibus_attr_list_append(text->attrs,
-                    ibus_attr_foreground_new(0xff0000, pos, pos+len));
+                ibus_rtk_engine_attr(rtk, IBUS_ATTR_TYPE_FOREGROUND,
+                    COLOR_NOT_FOUND, span->start, span->start+span->len);
             else
-                ibus_attr_list_append(text->attrs,
-                    ibus_attr_foreground_new(0x00ff00, pos, pos+len));
+                ibus_rtk_engine_attr(rtk, IBUS_ATTR_TYPE_FOREGROUND,
+                    COLOR_FOUND, span->start, span->start+span->len);
         }
-        pos += len+1;
+        // while typing known primitives are green and
+        // primitives no keyword starts with are red
+        else if(rtk_vocab_known(rtk->input[x].primitive))
+            ibus_rtk_engine_attr(rtk, IBUS_ATTR_TYPE_FOREGROUND,
+                COLOR_FOUND, span->start, span->start+span->len);
+        else if(span->len && !rtk_vocab_complete(rtk->input[x].primitive, &first))
+            ibus_rtk_engine_attr(rtk, IBUS_ATTR_TYPE_FOREGROUND,
+                COLOR_NOT_FOUND, span->start, span->start+span->len);
     }
     
-    ibus_engine_update_preedit_text((IBusEngine*)rtk, text, rtk->cursor, TRUE);
+    ibus_engine_update_preedit_text((IBusEngine*)rtk,
+        ibus_rtk_engine_text(rtk->preedit_text, rtk->preedit), rtk->cursor, TRUE);
     
     g_string_assign(rtk->prekanji, "");
-    ibus_engine_hide_auxiliary_text((IBusEngine*)rtk);
+    if(input)
+        ibus_engine_hide_auxiliary_text((IBusEngine*)rtk);
+    else
+        ibus_rtk_engine_complete(rtk);
     ibus_engine_hide_lookup_table((IBusEngine*)rtk);
 }
 
 static void ibus_rtk_engine_update_prekanji(IBusRTKEngine *rtk)
 {
-    IBusText *text;
-    
-    text = ibus_text_new_from_static_string(rtk->prekanji->str);
-    
-    ibus_engine_update_preedit_text((IBusEngine*)rtk, text, rtk->prekanji->len, TRUE);
+    ibus_engine_update_preedit_text((IBusEngine*)rtk,
+        ibus_rtk_engine_text(rtk->text, rtk->prekanji), rtk->prekanji->len, TRUE);
     ibus_engine_show_lookup_table((IBusEngine*)rtk);
 }
 
 static void ibus_rtk_engine_commit(IBusRTKEngine *rtk, GString *str)
 {
-    IBusText *text;
+    // remember which candidate was chosen for the query
+    if(str == rtk->prekanji && rtk->lookup)
+        rtk_history_add(rtk->query_hash,
+            rtk->lookup[ibus_lookup_table_get_cursor_pos(rtk->table)].number);
     
-    text = ibus_text_new_from_static_string(str->str);
-    ibus_engine_commit_text((IBusEngine*)rtk, text);
+    ibus_engine_commit_text((IBusEngine*)rtk, ibus_rtk_engine_text(rtk->text, str));
     
     ibus_rtk_engine_reset(rtk);
 }
 
-static void ibus_rtk_engine_update_lookup(IBusRTKEngine *rtk)
+static IBusText* ibus_rtk_engine_candidate(IBusRTKEngine *rtk, struct rtkresult *result)
 {
     IBusText *text;
-    guint pos;
+    guint key;
+    
+    // candidates are formatted once per entry and reused by every lookup,
+    // numberless entries share number 0 so the entry id is the key,
+    // partial matches are marked and cached apart
+    if(rtk->generation != generation)
+    {
+        g_hash_table_remove_all(rtk->candidates);
+        rtk->generation = generation;
+    }
+    key = (guint)result->id | (result->partial ? PARTIAL_KEY : 0);
+    text = g_hash_table_lookup(rtk->candidates, GUINT_TO_POINTER(key));
+    if(!text)
+    {
+        text = ibus_text_new_from_printf("%s[%u] %s %s", result->partial ? "~" : "",
+            result->number, result->kanji, result->meaning);
+        g_object_ref_sink(text);
+        g_hash_table_insert(rtk->candidates, GUINT_TO_POINTER(key), text);
+    }
+    
+    return text;
+}
+
+static void ibus_rtk_engine_fill_lookup(IBusRTKEngine *rtk, guint pos)
+{
+    guint x, fill;
+    
+    // materialize candidates up to the end of the page containing pos
+    // plus a small look-ahead, later pages are appended on demand
+    fill = (pos/LOOKUP_PAGE_SIZE+1)*LOOKUP_PAGE_SIZE + LOOKUP_AHEAD;
+    if(fill > rtk->lookup_count)
+        fill = rtk->lookup_count;
+    
+    // only the candidates shown get ordered
+    if(fill > rtk->ranked)
+    {
+        rtk_lookup_rank(rtk->lookup, rtk->lookup_count, rtk->ranked, fill);
+        rtk->ranked = fill;
+    }
+    
+    for(x=ibus_lookup_table_get_number_of_candidates(rtk->table); x<fill; x++)
+        ibus_lookup_table_append_candidate(rtk->table,
+            ibus_rtk_engine_candidate(rtk, &rtk->lookup[x]));
+}
+
+static void ibus_rtk_engine_update_lookup(IBusRTKEngine *rtk)
+{
+    gchar decomposition[DECOMPOSE_LEN];
+    guint pos, x;
     
     pos = ibus_lookup_table_get_cursor_pos(rtk->table);
-    text = ibus_text_new_from_printf("%i / %i", pos+1,
-        ibus_lookup_table_get_number_of_candidates(rtk->table));
+    g_string_printf(rtk->aux, "%i / %i", pos+1, rtk->lookup_count);
+    if(rtk->corrected->len)
+        g_string_append_printf(rtk->aux, " (%s)", rtk->corrected->str);
+    if(rtk->lookup[pos].partial)
+        g_string_append_printf(rtk->aux, " (%i of %i primitives)",
+            rtk->lookup[pos].partial, rtk->input_count);
+    
+    // the path to every primitive instead of the whole decomposition
+    if(explain)
+    {
+        for(x=0; x<rtk->input_count; x++)
+            if(rtk_context_explain(rtk->context, rtk->lookup[pos].id, x, decomposition, DECOMPOSE_LEN) > 0)
+                g_string_append_printf(rtk->aux, " | %s", decomposition);
+    }
+    else if(rtk_decompose(rtk->lookup[pos].id, decomposition, DECOMPOSE_LEN) > 0)
+        g_string_append_printf(rtk->aux, " %s = %s", rtk->lookup[pos].kanji, decomposition);
     
     g_string_assign(rtk->prekanji, rtk->lookup[pos].kanji);
     ibus_rtk_engine_update_prekanji(rtk);
     
-    ibus_engine_update_auxiliary_text((IBusEngine*)rtk, text, TRUE);
+    ibus_engine_update_auxiliary_text((IBusEngine*)rtk,
+        ibus_rtk_engine_text(rtk->aux_text, rtk->aux), TRUE);
     ibus_engine_update_lookup_table((IBusEngine*)rtk, rtk->table, TRUE);
 }
 
-static void ibus_rtk_engine_lookup(IBusRTKEngine *rtk)
+static void ibus_rtk_engine_lookup_down(IBusRTKEngine *rtk)
+{
+    ibus_rtk_engine_fill_lookup(rtk, ibus_lookup_table_get_cursor_pos(rtk->table)+1);
+    ibus_lookup_table_cursor_down(rtk->table);
+    ibus_rtk_engine_update_lookup(rtk);
+}
+
+static void ibus_rtk_engine_lookup_up(IBusRTKEngine *rtk)
+{
+    // wrapping around to the last candidate needs all of them
+    if(!ibus_lookup_table_get_cursor_pos(rtk->table))
+        ibus_rtk_engine_fill_lookup(rtk, rtk->lookup_count);
+    ibus_lookup_table_cursor_up(rtk->table);
+    ibus_rtk_engine_update_lookup(rtk);
+}
+
+static void ibus_rtk_engine_lookup_page_down(IBusRTKEngine *rtk)
+{
+    ibus_rtk_engine_fill_lookup(rtk, ibus_lookup_table_get_cursor_pos(rtk->table)+LOOKUP_PAGE_SIZE);
+    ibus_lookup_table_page_down(rtk->table);
+    ibus_rtk_engine_update_lookup(rtk);
+}
+
+static void ibus_rtk_engine_lookup_page_up(IBusRTKEngine *rtk)
+{
+    // wrapping around to the last page needs all candidates
+    if(ibus_lookup_table_get_cursor_pos(rtk->table) < LOOKUP_PAGE_SIZE)
+        ibus_rtk_engine_fill_lookup(rtk, rtk->lookup_count);
+    ibus_lookup_table_page_up(rtk->table);
+    ibus_rtk_engine_update_lookup(rtk);
+}
+
+static guint ibus_rtk_engine_lookup_result(IBusRTKEngine *rtk, struct rtkresult *result)
+{
+    lookups_open += (result != 0) - (rtk->lookup != 0);
+    rtk->lookup = result;
+    
+    rtk->lookup_count = 0;
+    if(rtk->lookup)
+        while(rtk->lookup[rtk->lookup_count].kanji)
+            rtk->lookup_count++;
+    
+    return rtk->lookup_count;
+}
+
+static guint ibus_rtk_engine_lookup_run(IBusRTKEngine *rtk)
+{
+    return ibus_rtk_engine_lookup_result(rtk, rtk_context_lookup(rtk->context, rtk->input_count, rtk->input));
+}
+
+static guint ibus_rtk_engine_lookup_input(IBusRTKEngine *rtk)
+{
+    ibus_rtk_engine_input(rtk, TRUE);
+    return ibus_rtk_engine_lookup_run(rtk);
+}
+
+static void ibus_rtk_engine_lookup_fuzzy(IBusRTKEngine *rtk)
 {
-    IBusText *text;
-    struct rtkresult *result;
     struct rtkinput *input;
-    guint x;
+    gchar *buf;
+    guint x, exclude;
     
-    input = g_malloc_n(rtk->primitive_count, sizeof(struct rtkinput));
-    for(x=0; x<rtk->primitive_count; x++)
-        input[x].primitive = g_array_index(rtk->primitives, GString*, x)->str;
+    // replace unknown primitives by the closest keyword and retry
+    for(x=0; x<rtk->input_count; x++)
+    {
+        input = &rtk->input[x];
+        if(input->found || rtk_vocab_known(input->primitive))
+            continue;
+        
+        // an excluded primitive stays excluded
+        buf = rtk->corrections + x*CORRECTION_LEN;
+        exclude = input->primitive[0] == '-';
+        buf[0] = '-';
+        if(rtk_vocab_fuzzy(input->primitive, buf+exclude, CORRECTION_LEN-exclude) == -1)
+            continue;
+        
+        if(rtk->corrected->len)
+            g_string_append(rtk->corrected, ", ");
+        g_string_append_printf(rtk->corrected, "%s → %s", input->primitive, buf);
+        input->primitive = buf;
+    }
     
-    rtk->lookup = result = rtk_lookup(rtk->primitive_count, input);
+    if(rtk->corrected->len)
+        ibus_rtk_engine_lookup_run(rtk);
+}
+
+static void ibus_rtk_engine_rank(IBusRTKEngine *rtk)
+{
+    struct rtkresult result;
+    gchar buf[RTK_WORD_LEN+3];
+    gdouble score;
+    guint x, y, len;
     
-    if(!result)
+    // the key is the terms as the lookup sees them, normalized and
+    // sorted since their order does not change the candidates
+    g_string_truncate(rtk->query, 0);
+    for(x=0; x<rtk->input_count; x++)
     {
-        ibus_rtk_engine_update_preedit(rtk, input);
-        g_free(input);
-        return;
+        // longer terms match no word
+        if(rtk_vocab_norm(rtk->input[x].primitive, buf) == -1)
+            continue;
+        
+        for(y=0; y<rtk->query->len; y+=len+1)
+        {
+            len = strcspn(rtk->query->str+y, "\n");
+            if(strncmp(rtk->query->str+y, buf, len) > 0)
+                break;
+        }
+        g_string_insert_c(rtk->query, y, '\n');
+        g_string_insert(rtk->query, y, buf);
     }
+    rtk->query_hash = rtk_history_query(rtk->query->str);
     
-    g_free(input);
+    // move candidates chosen before to the front ordered by score
+    // the rest is ranked by rtk_lookup_rank when shown
+    g_array_set_size(rtk->scores, 0);
+    for(x=0; x<rtk->lookup_count; x++)
+    {
+        score = rtk_history_score(rtk->query_hash, rtk->lookup[x].number);
+        if(score <= 0)
+            continue;
+        
+        for(y=rtk->scores->len; y && g_array_index(rtk->scores, gdouble, y-1) < score; y--);
+        
+        result = rtk->lookup[x];
+        memmove(&rtk->lookup[y+1], &rtk->lookup[y], (x-y)*sizeof(struct rtkresult));
+        rtk->lookup[y] = result;
+        g_array_insert_val(rtk->scores, y, score);
+    }
     
-    ibus_lookup_table_clear(rtk->table);
+    rtk->ranked = rtk->scores->len;
+}
+
+static void ibus_rtk_engine_lookup(IBusRTKEngine *rtk)
+{
+    struct rtksegmentation seg[SEGMENT_ALTERNATIVES];
+    guint x, y, alternatives, count, best, choice;
+    gboolean redo = FALSE;
+    
+    g_array_set_size(rtk->choice, rtk->primitive_count);
+    for(x=0; x<rtk->primitive_count; x++)
+        g_array_index(rtk->choice, guint, x) = 0;
+    
+    best = ibus_rtk_engine_lookup_input(rtk);
+    
+    // rank ambiguous segmentations by their number of results
+    // one primitive after the other keeping the choices made before
+    if(segment)
+        for(x=0; x<rtk->primitive_count; x++)
+        {
+            alternatives = rtk_segment(g_array_index(rtk->primitives, GString*, x)->str,
+                seg, SEGMENT_ALTERNATIVES);
+            for(y=1, choice=0; y<alternatives; y++)
+            {
+                g_array_index(rtk->choice, guint, x) = y;
+                count = ibus_rtk_engine_lookup_input(rtk);
+                if(count > best)
+                {
+                    best = count;
+                    choice = y;
+                }
+                redo = TRUE;
+            }
+            g_array_index(rtk->choice, guint, x) = choice;
+        }
+    
+    if(redo)
+        ibus_rtk_engine_lookup_input(rtk);
     
-    while(result->kanji)
+    g_string_truncate(rtk->corrected, 0);
+    if(!rtk->lookup && fuzzy)
+        ibus_rtk_engine_lookup_fuzzy(rtk);
+    
+    // fall back to kanji containing only some of the primitives
+    if(!rtk->lookup && rtk->input_count > 1)
+        ibus_rtk_engine_lookup_result(rtk, rtk_context_partial(rtk->context, rtk->input_count, rtk->input));
+    
+    if(!rtk->lookup)
     {
-        text = ibus_text_new_from_printf("[%u] %s %s", result->number, result->kanji, result->meaning);
-        ibus_lookup_table_append_candidate(rtk->table, text);
-        result++;
+        ibus_rtk_engine_update_preedit(rtk, rtk->input);
+        return;
     }
     
+    ibus_rtk_engine_rank(rtk);
+    
+    ibus_lookup_table_clear(rtk->table);
+    ibus_rtk_engine_fill_lookup(rtk, 0);
+    
     ibus_rtk_engine_update_lookup(rtk);
 }
 
@@ -259,9 +764,11 @@ static gboolean ibus_rtk_engine_process_key_event(IBusEngine *engine, guint keyv
             case IBUS_minus:
             case IBUS_plus:
             case IBUS_asterisk:
+            case IBUS_numbersign:
+            case IBUS_equal:
                 goto input;
             default:
-                if(is_alpha(keyval))
+                if(is_alpha(keyval) || is_digit(keyval))
                     goto input;
             }
         }
@@ -284,8 +791,7 @@ static gboolean ibus_rtk_engine_process_key_event(IBusEngine *engine, guint keyv
                     tmpstr = primitive_current(-1);
                     rtk->cursor -= tmpstr->len+1;
                     g_string_erase(rtk->preedit, rtk->cursor, tmpstr->len+1);
-                    g_array_remove_index(rtk->primitives, rtk->primitive_current-1);
-                    rtk->primitive_count--;
+                    ibus_rtk_engine_primitive_remove(rtk, rtk->primitive_current-1, 1);
                     rtk->primitive_current--;
                     ibus_rtk_engine_update_preedit(rtk, 0);
                 }
@@ -295,8 +801,7 @@ static gboolean ibus_rtk_engine_process_key_event(IBusEngine *engine, guint keyv
                 rtk->cursor = 0;
                 g_string_erase(primitive_current(0), 0, rtk->primitive_cursor);
                 rtk->primitive_cursor = 0;
-                g_array_remove_range(rtk->primitives, 0, rtk->primitive_current);
-                rtk->primitive_count -= rtk->primitive_current;
+                ibus_rtk_engine_primitive_remove(rtk, 0, rtk->primitive_current);
                 rtk->primitive_current = 0;
                 ibus_rtk_engine_update_preedit(rtk, 0);
                 break;
@@ -345,10 +850,7 @@ static gboolean ibus_rtk_engine_process_key_event(IBusEngine *engine, guint keyv
     {
     case IBUS_Tab:
         if(rtk->prekanji->len)
-        {
-            ibus_lookup_table_cursor_down(rtk->table);
-            ibus_rtk_engine_update_lookup(rtk);
-        }
+            ibus_rtk_engine_lookup_down(rtk);
         else if(rtk->preedit->len)
             ibus_rtk_engine_lookup(rtk);
         break;
@@ -387,8 +889,7 @@ backspace:  rtk->cursor--;
                 tmpstr = primitive_current(-1);
                 rtk->primitive_cursor = tmpstr->len;
                 g_string_append(tmpstr, primitive_current(0)->str);
-                g_array_remove_index(rtk->primitives, rtk->primitive_current);
-                rtk->primitive_count--;
+                ibus_rtk_engine_primitive_remove(rtk, rtk->primitive_current, 1);
                 rtk->primitive_current--;
             }
             ibus_rtk_engine_update_preedit(rtk, 0);
@@ -410,31 +911,19 @@ backspace:  rtk->cursor--;
         break;
     case IBUS_Down:
         if(rtk->prekanji->len)
-        {
-            ibus_lookup_table_cursor_down(rtk->table);
-            ibus_rtk_engine_update_lookup(rtk);
-        }
+            ibus_rtk_engine_lookup_down(rtk);
         break;
     case IBUS_Up:
         if(rtk->prekanji->len)
-        {
-            ibus_lookup_table_cursor_up(rtk->table);
-            ibus_rtk_engine_update_lookup(rtk);
-        }
+            ibus_rtk_engine_lookup_up(rtk);
         break;
     case IBUS_Page_Down:
         if(rtk->prekanji->len)
-        {
-            ibus_lookup_table_page_down(rtk->table);
-            ibus_rtk_engine_update_lookup(rtk);
-        }
+            ibus_rtk_engine_lookup_page_down(rtk);
         break;
     case IBUS_Page_Up:
         if(rtk->prekanji->len)
-        {
-            ibus_lookup_table_page_up(rtk->table);
-            ibus_rtk_engine_update_lookup(rtk);
-        }
+            ibus_rtk_engine_lookup_page_up(rtk);
         break;
     case IBUS_Left:
         if(rtk->preedit->len && rtk->cursor > 0)
@@ -473,9 +962,7 @@ backspace:  rtk->cursor--;
         rtk->cursor++;
         ibus_rtk_engine_update_preedit(rtk, 0);
         
-        tmpstr = g_string_new("");
-        g_array_insert_val(rtk->primitives, rtk->primitive_current+1, tmpstr);
-        rtk->primitive_count++;
+        ibus_rtk_engine_primitive_insert(rtk, rtk->primitive_current+1);
         
         tmpstr = primitive_current(0);
         if(rtk->primitive_cursor < tmpstr->len)
@@ -502,9 +989,11 @@ end:    rtk->cursor = rtk->preedit->len;
     case IBUS_minus:
     case IBUS_plus:
     case IBUS_asterisk:
+    case IBUS_numbersign:
+    case IBUS_equal:
         goto input;
     default:
-        if(is_alpha(keyval))
+        if(is_alpha(keyval) || is_digit(keyval))
         {
 input:      g_string_insert_c(rtk->preedit, rtk->cursor, keyval);
             rtk->cursor++;
@@ -520,5 +1009,16 @@ input:      g_string_insert_c(rtk->preedit, rtk->cursor, keyval);
 
 static void ibus_rtk_engine_focus_in(IBusEngine *engine)
 {
-    ibus_rtk_engine_update_preedit((IBusRTKEngine*)engine, 0);
+    IBusRTKEngine *rtk = (IBusRTKEngine*)engine;
+    
+    // pick up edited dictionary layers between inputs, results of
+    // lookups still open in other engines point into the index,
+    // entry ids change so other engines drop their candidates too
+    if(!rtk->preedit->len && !rtk->prekanji->len && !lookups_open && rtk_lookup_reload())
+    {
+        g_hash_table_remove_all(rtk->candidates);
+        rtk->generation = ++generation;
+    }
+    
+    ibus_rtk_engine_update_preedit(rtk, 0);
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ibus.h>
+#include "engine.h"
+
+#define ROUNDS 4
+
+// counts the heap allocations of the engine per key, ibus is left out
+// by wrapping the calls emitting its signals at link time, they
+// serialize the texts on every update, once with the defaults and
+// once with every option on
+
+gchar **dicts = 0;
+gboolean verbose = FALSE;
+gboolean segment = FALSE;
+gboolean fuzzy = FALSE;
+gboolean explain = FALSE;
+
+static const char *dict =
+    "# number:skip:kanji:meaning:alternatives:primitives\n"
+    "1:0:一:one:-:-\n"
+    "2:0:二:two:-:-\n"
+    "3:0:三:three:-:one/two\n"
+    "4:0:口:mouth:-:-\n"
+    "5:0:日:day:sun:mouth/one\n"
+    "6:0:月:month:moon:-\n"
+    "7:0:明:bright:-:sun/moon\n"
+    "8:0:品:goods:-:mouth/mouth/mouth\n";
+
+static const struct
+{
+    gboolean segment, fuzzy, explain;
+    const char *input;
+} configs[] =
+{
+    {FALSE, FALSE, FALSE, "mouth one"},
+    {TRUE, TRUE, TRUE, "mouthone moon"},
+};
+
+static int counting;
+static unsigned long allocations;
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    allocations += counting;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations += counting;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+    allocations += counting;
+    return __libc_realloc(ptr, size);
+}
+
+void __wrap_ibus_engine_update_preedit_text(IBusEngine *engine, IBusText *text, guint cursor, gboolean visible) {}
+void __wrap_ibus_engine_hide_preedit_text(IBusEngine *engine) {}
+void __wrap_ibus_engine_update_auxiliary_text(IBusEngine *engine, IBusText *text, gboolean visible) {}
+void __wrap_ibus_engine_hide_auxiliary_text(IBusEngine *engine) {}
+void __wrap_ibus_engine_update_lookup_table(IBusEngine *engine, IBusLookupTable *table, gboolean visible) {}
+void __wrap_ibus_engine_show_lookup_table(IBusEngine *engine) {}
+void __wrap_ibus_engine_hide_lookup_table(IBusEngine *engine) {}
+void __wrap_ibus_engine_commit_text(IBusEngine *engine, IBusText *text) {}
+
+unsigned long key(IBusEngine *engine, guint keyval)
+{
+    unsigned long count;
+    
+    allocations = 0;
+    counting = 1;
+    IBUS_ENGINE_GET_CLASS(engine)->process_key_event(engine, keyval, 0, 0);
+    IBUS_ENGINE_GET_CLASS(engine)->process_key_event(engine, keyval, 0, IBUS_RELEASE_MASK);
+    counting = 0;
+    count = allocations;
+    
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/enginetestXXXXXX", path[64], cmd[64];
+    gchar *files[2] = {path, 0};
+    IBusEngine *engine;
+    FILE *file;
+    const char *input;
+    unsigned long count;
+    int x, c, round, failed = 0;
+    
+    if(!mkdtemp(dir))
+        return 99;
+    snprintf(path, sizeof(path), "%s/primitives", dir);
+    if(!(file = fopen(path, "w")))
+        return 99;
+    fputs(dict, file);
+    fclose(file);
+    
+    // the history goes next to the dictionary
+    g_setenv("XDG_DATA_HOME", dir, TRUE);
+    dicts = files;
+    
+    ibus_init();
+    
+    // segmentation splits the unspaced input on every key typed,
+    // correction and explanation run on the lookup only, whose
+    // candidates are ibus texts made once per entry and not counted
+    for(c=0; c<(int)G_N_ELEMENTS(configs); c++)
+    {
+        segment = configs[c].segment;
+        fuzzy = configs[c].fuzzy;
+        explain = configs[c].explain;
+        input = configs[c].input;
+        engine = g_object_new(IBUS_TYPE_RTK_ENGINE, "engine-name", "rtk",
+            "object-path", "/org/freedesktop/IBus/Engine/1", NULL);
+        
+        // the first rounds grow the buffers, later ones reuse them,
+        // every round ends with a lookup committing the kanji
+        for(round=0; round<ROUNDS; round++)
+        {
+            for(x=0; input[x]; x++)
+            {
+                count = key(engine, input[x] == ' ' ? IBUS_space : input[x]);
+                if(round)
+                    printf("options %i round %i key '%c': %lu allocations\n", c, round, input[x], count);
+                if(round && input[x] != ' ' && count)
+                    failed = 1;
+            }
+            key(engine, IBUS_Tab);
+            key(engine, IBUS_Return);
+        }
+        
+        ibus_object_destroy((IBusObject*)engine);
+    }
+    
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if(system(cmd))
+        return 99;
+    
+    if(failed)
+        printf("plain keys allocate after the first round\n");
+    return failed;
+}
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "history.h"
+
+#define HISTORY_MAGIC "RTKHIST2"
+#define HISTORY_MAGIC_LEN 8
+#define HISTORY_COMPACT 1024
+#define HISTORY_HALFLIFE (30*24*60*60)
+#define HISTORY_FLUSH 1
+
+#define print(format, ...) if(verbose) g_print(format, __VA_ARGS__)
+#define warn(format, ...) if(verbose) g_printerr(format, __VA_ARGS__)
+
+extern gboolean verbose;
+
+// one commit per record, compaction sums up records with equal key
+struct rtkrecord
+{
+    guint64 query, time;
+    guint32 number, count;
+};
+
+struct rtkcompact
+{
+    GArray *records;
+    gboolean done;
+};
+
+static GHashTable *rtk_history;
+static GArray *rtk_pending;
+static gchar *rtk_history_file, *rtk_history_lockfile;
+static gint rtk_history_fd = -1, rtk_history_lock_fd = -1, rtk_history_refs;
+static guint rtk_history_records;
+static GThread *rtk_compactor;
+static guint rtk_history_next = HISTORY_COMPACT, rtk_history_timer;
+static struct rtkcompact *rtk_compact;
+
+static gboolean rtk_history_compacted(gpointer data);
+
+
+static guint rtk_history_hash(gconstpointer key)
+{
+    const struct rtkrecord *record = key;
+    
+    return (guint)(record->query ^ record->query >> 32)*31 + record->number;
+}
+
+static gboolean rtk_history_equal(gconstpointer a, gconstpointer b)
+{
+    const struct rtkrecord *ra = a, *rb = b;
+    
+    return ra->query == rb->query && ra->number == rb->number;
+}
+
+static void rtk_history_update(GHashTable *history, const struct rtkrecord *record)
+{
+    struct rtkrecord *entry;
+    
+    if(!(entry = g_hash_table_lookup(history, record)))
+    {
+        entry = g_new0(struct rtkrecord, 1);
+        entry->query = record->query;
+        entry->number = record->number;
+        g_hash_table_insert(history, entry, entry);
+    }
+    
+    entry->count += record->count;
+    if(record->time > entry->time)
+        entry->time = record->time;
+}
+
+static GHashTable* rtk_history_new()
+{
+    return g_hash_table_new_full(rtk_history_hash, rtk_history_equal, g_free, NULL);
+}
+
+static gssize rtk_history_parse(GHashTable *history, const gchar *contents, gsize len)
+{
+    gsize x;
+    
+    if(len < HISTORY_MAGIC_LEN || memcmp(contents, HISTORY_MAGIC, HISTORY_MAGIC_LEN))
+        return -1;
+    
+    // a record cut short by a crash is dropped
+    len = (len-HISTORY_MAGIC_LEN)/sizeof(struct rtkrecord);
+    for(x=0; x<len; x++)
+        rtk_history_update(history, (const struct rtkrecord*)(contents+HISTORY_MAGIC_LEN)+x);
+    
+    return len;
+}
+
+static gboolean rtk_history_load()
+{
+    GMappedFile *file;
+    gssize records;
+    
+    // the file is only read at startup, mapping it avoids copying it
+    if(!(file = g_mapped_file_new(rtk_history_file, FALSE, NULL)))
+        return FALSE;
+    
+    records = rtk_history_parse(rtk_history, g_mapped_file_get_contents(file),
+        g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
+    
+    if(records == -1)
+    {
+        warn("History file %s invalid, starting over\n", rtk_history_file);
+        return FALSE;
+    }
+    rtk_history_records = records;
+    
+    print("History: %u records, %u entries\n", rtk_history_records,
+        g_hash_table_size(rtk_history));
+    
+    return TRUE;
+}
+
+static gboolean rtk_history_write(gint fd, const void *data, gsize len)
+{
+    gssize ret;
+    
+    while(len)
+    {
+        if((ret = write(fd, data, len)) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            warn("Failed to write history: %s\n", g_strerror(errno));
+            return FALSE;
+        }
+        data = (const gchar*)data + ret;
+        len -= ret;
+    }
+    
+    return TRUE;
+}
+
+static gint rtk_history_open(const gchar *file, gboolean valid)
+{
+    gint fd;
+    
+    if(valid)
+        return g_open(file, O_WRONLY|O_APPEND, 0600);
+    
+    if((fd = g_open(file, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0600)) == -1)
+        return -1;
+    
+    if(!rtk_history_write(fd, HISTORY_MAGIC, HISTORY_MAGIC_LEN))
+    {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+static gboolean rtk_history_lock(gint fd, gboolean wait)
+{
+    // every engine process appends to the same file, the lock file
+    // keeps appends apart from another process compacting it
+    if(fd == -1)
+        return TRUE;
+    while(flock(fd, wait ? LOCK_EX : LOCK_EX|LOCK_NB) == -1)
+        if(errno != EINTR)
+            return FALSE;
+    return TRUE;
+}
+
+static void rtk_history_unlock(gint fd)
+{
+    if(fd != -1)
+        flock(fd, LOCK_UN);
+}
+
+static void rtk_history_flush()
+{
+    struct stat opened, current;
+    
+    // a compaction may have replaced the file since it was opened
+    if(rtk_history_fd != -1 && (fstat(rtk_history_fd, &opened) || g_stat(rtk_history_file, &current)
+        || opened.st_ino != current.st_ino || opened.st_dev != current.st_dev))
+    {
+        close(rtk_history_fd);
+        rtk_history_fd = -1;
+    }
+    if(rtk_history_fd == -1)
+        rtk_history_fd = rtk_history_open(rtk_history_file,
+            g_file_test(rtk_history_file, G_FILE_TEST_EXISTS));
+    
+    // without a file the history is kept for this session only
+    if(rtk_history_fd != -1)
+        rtk_history_write(rtk_history_fd, rtk_pending->data, rtk_pending->len*sizeof(struct rtkrecord));
+    rtk_history_records += rtk_pending->len;
+    g_array_set_size(rtk_pending, 0);
+}
+
+static gpointer rtk_history_compact_thread(gpointer data)
+{
+    struct rtkcompact *compact = data;
+    GHashTable *history;
+    GHashTableIter iter;
+    gpointer entry;
+    gchar *contents, *tmp;
+    gsize len;
+    gint fd, lock;
+    
+    // a lock of its own, the engine thread holds the other one
+    lock = g_open(rtk_history_lockfile, O_RDWR|O_CREAT, 0600);
+    rtk_history_lock(lock, TRUE);
+    
+    // the file holds the commits of every engine process,
+    // not only those this one knows of
+    history = rtk_history_new();
+    if(g_file_get_contents(rtk_history_file, &contents, &len, NULL))
+    {
+        compact->done = rtk_history_parse(history, contents, len) != -1;
+        g_free(contents);
+    }
+    
+    g_hash_table_iter_init(&iter, history);
+    while(g_hash_table_iter_next(&iter, &entry, NULL))
+        g_array_append_vals(compact->records, entry, 1);
+    g_hash_table_destroy(history);
+    
+    tmp = g_strconcat(rtk_history_file, ".tmp", NULL);
+    if(compact->done && (fd = rtk_history_open(tmp, FALSE)) != -1)
+    {
+        compact->done = rtk_history_write(fd, compact->records->data,
+            compact->records->len*sizeof(struct rtkrecord));
+        compact->done = !close(fd) && compact->done;
+        compact->done = compact->done && !g_rename(tmp, rtk_history_file);
+        if(!compact->done)
+            g_unlink(tmp);
+    }
+    else
+        compact->done = FALSE;
+    g_free(tmp);
+    
+    if(lock != -1)
+        close(lock);
+    
+    g_idle_add(rtk_history_compacted, compact);
+    
+    return NULL;
+}
+
+static gboolean rtk_history_compacted(gpointer data)
+{
+    struct rtkcompact *compact = data;
+    guint x;
+    
+    if(rtk_compactor)
+        g_thread_join(rtk_compactor);
+    rtk_compactor = 0;
+    
+    // the compacted file is what every process committed so far,
+    // commits not written yet are added on top
+    if(compact->done)
+    {
+        g_hash_table_remove_all(rtk_history);
+        for(x=0; x<compact->records->len; x++)
+            rtk_history_update(rtk_history, &g_array_index(compact->records, struct rtkrecord, x));
+        for(x=0; x<rtk_pending->len; x++)
+            rtk_history_update(rtk_history, &g_array_index(rtk_pending, struct rtkrecord, x));
+        rtk_history_records = compact->records->len;
+        rtk_history_next = HISTORY_COMPACT;
+        print("History compacted to %u records\n", rtk_history_records);
+    }
+    else
+        rtk_history_next = rtk_history_records + HISTORY_COMPACT;
+    
+    g_array_free(compact->records, TRUE);
+    g_free(compact);
+    rtk_compact = 0;
+    
+    if(rtk_pending->len && rtk_history_lock(rtk_history_lock_fd, FALSE))
+    {
+        rtk_history_flush();
+        rtk_history_unlock(rtk_history_lock_fd);
+    }
+    
+    return G_SOURCE_REMOVE;
+}
+
+static void rtk_history_compact()
+{
+    // the thread does all the file work
+    rtk_compact = g_new0(struct rtkcompact, 1);
+    rtk_compact->records = g_array_sized_new(FALSE, FALSE, sizeof(struct rtkrecord),
+        g_hash_table_size(rtk_history));
+    
+    rtk_compactor = g_thread_new("rtk-history", rtk_history_compact_thread, rtk_compact);
+}
+
+int rtk_history_init()
+{
+    gchar *dir;
+    gboolean valid;
+    
+    // the history is shared by all engines
+    if(rtk_history_refs++)
+        return 0;
+    
+    rtk_history = rtk_history_new();
+    rtk_pending = g_array_new(FALSE, FALSE, sizeof(struct rtkrecord));
+    rtk_history_records = 0;
+    rtk_history_next = HISTORY_COMPACT;
+    
+    dir = g_build_filename(g_get_user_data_dir(), "ibus-rtk", NULL);
+    rtk_history_file = g_build_filename(dir, "history", NULL);
+    rtk_history_lockfile = g_build_filename(dir, "history.lock", NULL);
+    if(g_mkdir_with_parents(dir, 0700) == -1)
+        warn("Failed to create %s: %s\n", dir, g_strerror(errno));
+    g_free(dir);
+    
+    if((rtk_history_lock_fd = g_open(rtk_history_lockfile, O_RDWR|O_CREAT, 0600)) == -1)
+        warn("Failed to open history lock %s: %s\n", rtk_history_lockfile, g_strerror(errno));
+    
+    rtk_history_lock(rtk_history_lock_fd, TRUE);
+    valid = rtk_history_load();
+    rtk_history_fd = rtk_history_open(rtk_history_file, valid);
+    rtk_history_unlock(rtk_history_lock_fd);
+    
+    // without a file the history is kept for this session only
+    if(rtk_history_fd == -1)
+    {
+        warn("Failed to open history %s: %s\n", rtk_history_file, g_strerror(errno));
+        return 1;
+    }
+    
+    return 0;
+}
+
+void rtk_history_free()
+{
+    if(!rtk_history_refs || --rtk_history_refs)
+        return;
+    
+    if(rtk_history_timer)
+        g_source_remove(rtk_history_timer);
+    rtk_history_timer = 0;
+    
+    // finish a running compaction, its idle callback would come too late
+    if(rtk_compact)
+    {
+        g_thread_join(rtk_compactor);
+        rtk_compactor = 0;
+        g_source_remove_by_user_data(rtk_compact);
+        rtk_history_compacted(rtk_compact);
+    }
+    
+    // commits not written yet wait for the lock once
+    if(rtk_pending->len && rtk_history_lock(rtk_history_lock_fd, TRUE))
+    {
+        rtk_history_flush();
+        rtk_history_unlock(rtk_history_lock_fd);
+    }
+    
+    if(rtk_history_fd != -1)
+        close(rtk_history_fd);
+    if(rtk_history_lock_fd != -1)
+        close(rtk_history_lock_fd);
+    rtk_history_fd = rtk_history_lock_fd = -1;
+    
+    g_hash_table_destroy(rtk_history);
+    g_array_free(rtk_pending, TRUE);
+    g_free(rtk_history_file);
+    g_free(rtk_history_lockfile);
+    rtk_history = 0;
+    rtk_pending = 0;
+    rtk_history_file = rtk_history_lockfile = 0;
+}
+
+guint64 rtk_history_query(const gchar *query)
+{
+    guint64 hash = 14695981039346656037ull;
+    
+    // 64 bit fnv-1a, queries sharing a key would share their history
+    while(*query)
+        hash = (hash ^ (guchar)*query++) * 1099511628211ull;
+    
+    return hash;
+}
+
+static gboolean rtk_history_flushed(gpointer data)
+{
+    // appends are small, the file is only rewritten by compaction,
+    // while another process or the thread compacts records wait for
+    // the next tick instead of the lock
+    if(rtk_compact || !rtk_history_lock(rtk_history_lock_fd, FALSE))
+        return G_SOURCE_CONTINUE;
+    rtk_history_flush();
+    rtk_history_unlock(rtk_history_lock_fd);
+    
+    if(rtk_history_records >= rtk_history_next
+        && rtk_history_records > 2*g_hash_table_size(rtk_history))
+        rtk_history_compact();
+    
+    rtk_history_timer = 0;
+    return G_SOURCE_REMOVE;
+}
+
+void rtk_history_add(guint64 query, guint32 number)
+{
+    struct rtkrecord record;
+    
+    if(!rtk_history)
+        return;
+    
+    record.query = query;
+    record.number = number;
+    record.count = 1;
+    record.time = g_get_real_time()/G_USEC_PER_SEC;
+    
+    // the commit only touches memory, the file is written later
+    rtk_history_update(rtk_history, &record);
+    g_array_append_val(rtk_pending, record);
+    if(!rtk_history_timer)
+        rtk_history_timer = g_timeout_add_seconds(HISTORY_FLUSH, rtk_history_flushed, 0);
+}
+
+gdouble rtk_history_score(guint64 query, guint32 number)
+{
+    struct rtkrecord key, *entry;
+    gint64 age;
+    
+    key.query = query;
+    key.number = number;
+    
+    if(!rtk_history || !(entry = g_hash_table_lookup(rtk_history, &key)))
+        return 0;
+    
+    // commit count, halved after HISTORY_HALFLIFE seconds without a commit
+    age = g_get_real_time()/G_USEC_PER_SEC - (gint64)entry->time;
+    if(age < 0)
+        age = 0;
+    
+    return entry->count / (1.0 + (gdouble)age/HISTORY_HALFLIFE);
+}
@@ -24,27 +24,46 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "lookup.h"
 
 #ifndef IBUS_RTK
 #   define print(format, ...) fprintf(stdout, format, __VA_ARGS__)
 #   define warn(format, ...) fprintf(stderr, format, __VA_ARGS__)
+#   define plan(format, ...) if(rtk_verbose) fprintf(stdout, format, __VA_ARGS__)
 #   define error(str) perror(str)
+    int rtk_verbose;
 #else
 #   include <glib.h>
 #   define print(format, ...) if(verbose) g_print(format, __VA_ARGS__)
 #   define warn(format, ...) if(verbose) g_printerr(format, __VA_ARGS__)
+#   define plan(format, ...) print(format, __VA_ARGS__)
 #   define error(str) g_printerr("%s: %s\n", str, g_strerror(errno))
     extern gboolean verbose;
 #endif
 
 #define DEFAULT_CAP 10
+#define PROBE_RATIO 8
+#define FREQ_FILE "frequency"
 #define FLAG_PREFIX 1
 #define FLAG_FOUND  2
 
+#define PHASE_PARSE     0
+#define PHASE_VOCAB     1
+#define PHASE_SUFFIX    2
+#define PHASE_CLOSURE   3
+#define PHASE_KANJI     4
+#define PHASE_SEGMENT   5
+#define PHASE_FREQ      6
+#define PHASE_BKTREE    7
+
 #define PREFIX(p) ((p).flag & FLAG_PREFIX)
 
+#define rtk_string(off) (rtk_strings+(off))
+#define rtk_word(id) rtk_string(rtk_word_str[id])
+
 struct rtkprim
 {
     char **prim;
@@ -52,37 +71,150 @@ struct rtkprim
     char flag;
 };
 
+struct rtkbktree
+{
+    int child, next, dist;
+};
+
+struct rtkterm
+{
+    int first, count, words, times, found, size, input;
+    char exclude;
+};
+
+struct rtkclosure
+{
+    int *def_start, *defs, *pos, *slot, *cstart, *cwords, *cpred, ccap, pmark;
+    int *stamp, *list, *total, *pstamp, *pmax, *plist, *pred, *ppred;
+    unsigned char *ctimes;
+};
+
+struct rtklayer
+{
+    const char *file;
+    time_t mtime;
+    off_t size;
+};
+
+// layers merged in memory, lines point into the read files
+struct rtkmerge
+{
+    char **bufs, **lines;
+    int *lens, *nums, count;
+    unsigned long long *hashes, digest;
+    struct rtklayer *stamps;
+};
+
+// entries of the lines a reload changed or appended
+struct rtkupdate
+{
+    int count, *entry, *name_start, *names, *prim_start, *prims;
+    int name_count, name_cap, prim_count, prim_cap;
+    unsigned int *number;
+    unsigned char *skip;
+    char **kanji, **meaning;
+};
+
+struct rtksegstate
+{
+    char str[RTK_SEGMENT_LEN+2], reach[RTK_SEGMENT_LEN+2];
+    int len, max, found;
+    struct rtksegmentation *seg;
+    struct rtksegment cur[RTK_SEGMENT_MAX];
+};
+
+// scratch of lookups, the index itself is only read by them
+// so every thread looking up in parallel owns one
+struct rtkcontext
+{
+    struct rtkresult *results;
+    int result_count, result_cap, result_allot;
+    struct rtkterm *terms;
+    int *term_of, *term_order, term_cap, term_inputs;
+    int *set, *set_term, *match_count, *touched, entries;
+    char *match_stamp;
+    int *pool, pool_len, pool_cap, *pattern_words, pattern_cap;
+    int *decode, *decode_pred, decode_cap;
+    unsigned char *decode_times;
+    char *scan;
+};
+
+
+struct rtklayer *rtk_layers;
+unsigned long long rtk_digest, *rtk_line_hash;
+int rtk_layer_count, rtk_line_count;
+struct rtkcontext rtk_context;
+
+// entries are parallel arrays, kanji, meanings and words
+// offsets into one pool starting with the sorted words
+char *rtk_strings;
+unsigned char *rtk_skip, *rtk_contain;
+unsigned int *rtk_numbers, *rtk_freq, *rtk_kanji, *rtk_meaning, *rtk_word_str, *rtk_contain_start;
+int *rtk_name_start, *rtk_names, *rtk_prim_start, *rtk_prims;
+struct rtkbktree *rtk_bktree;
+int *rtk_post_start, *rtk_posts;
+int *rtk_word_def, *rtk_kanji_hash, *rtk_word_hash;
+int *rtk_frames, *rtk_named_start, *rtk_named;
+int *rtk_sa, *rtk_joined;
+int rtk_entry_count, rtk_word_count, rtk_string_len, rtk_string_cap, rtk_text_len, rtk_contain_max;
+int rtk_joined_count, rtk_refs;
+int rtk_kanji_size, rtk_word_size, rtk_frame_count, rtk_sa_count;
 
-FILE *rtk_dict;
-struct rtkresult *rtk_results;
-int rtk_result_count, rtk_result_cap, rtk_result_allot;
+// what the last load took and left out, for rtk_lookup_stats
+const char *rtk_phase_name[RTK_STATS_PHASES] = {"parse", "vocabulary", "suffix array", "closure", "kanji index", "segmentation", "frequency", "bk-tree"};
+double rtk_phase_ms[RTK_STATS_PHASES];
+char **rtk_unparsable;
+int *rtk_orphans, *rtk_unparsable_line, rtk_unparsable_count, rtk_unparsable_cap;
 
 
-void rtk_result_add(unsigned int number, char *kanji, char *meaning, int allot)
+double rtk_clock()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3+ts.tv_nsec/1e6;
+}
+
+int rtk_result_slot(struct rtkcontext *c, int allot)
 {
-    int pos = rtk_result_count;
+    int pos = c->result_count;
     
-    if(rtk_result_count == rtk_result_cap-1)
+    // doubled, lookups at unihan scale return thousands
+    if(c->result_count == c->result_cap-1)
     {
-        rtk_result_cap += DEFAULT_CAP;
-        rtk_results = realloc(rtk_results, rtk_result_cap*sizeof(struct rtkresult));
-        memset(rtk_results+rtk_result_count, 0, (rtk_result_cap-rtk_result_count)*sizeof(struct rtkresult));
+        c->result_cap *= 2;
+        c->results = realloc(c->results, c->result_cap*sizeof(struct rtkresult));
+        memset(c->results+c->result_count, 0, (c->result_cap-c->result_count)*sizeof(struct rtkresult));
     }
     if(allot)
     {
-        memmove(rtk_results+rtk_result_allot+1, rtk_results+rtk_result_allot, (rtk_result_count-rtk_result_allot)*sizeof(struct rtkresult));
-        pos = rtk_result_allot++;
+        memmove(c->results+c->result_allot+1, c->results+c->result_allot, (c->result_count-c->result_allot)*sizeof(struct rtkresult));
+        pos = c->result_allot++;
     }
-    rtk_results[pos].number = number;
-    rtk_results[pos].kanji = strdup(kanji);
-    rtk_results[pos].meaning = strdup(meaning);
-    rtk_result_count++;
+    c->results[pos].allot = allot;
+    c->result_count++;
+    
+    return pos;
+}
+
+void rtk_result_add(struct rtkcontext *c, int id, int allot)
+{
+    int pos = rtk_result_slot(c, allot);
+    
+    // strings are shared with the index until it is rebuilt
+    c->results[pos].number = rtk_numbers[id];
+    c->results[pos].kanji = rtk_string(rtk_kanji[id]);
+    c->results[pos].meaning = rtk_string(rtk_meaning[id]);
+    c->results[pos].id = id;
 }
 
 char* rtk_norm(char *str, int plural)
 {
     char *s = str;
     
+    if(!*s)
+        return str;
+    
     while(*s)
     {
         // substitute upper for lower characters
@@ -107,13 +239,13 @@ char* rtk_norm(char *str, int plural)
     
     // remove trailing whitespace
     --s;
-    while(*s == ' ' && s >= str)
+    while(s >= str && *s == ' ')
         *s-- = 0;
     
     // remove plural 's'
     // non plural words are severed but two primitives
     // should not differ by only the trailing 's'
-    if(!plural && *s == 's')
+    if(!plural && s >= str && *s == 's')
         *s = 0;
     
     return str;
@@ -124,7 +256,7 @@ void rtk_prim_add(char *str, struct rtkprim *p, int norm, int prefix)
     int len = strlen(str);
     char *prim;
     
-    if(str[len-1] == '\n')
+    if(len && str[len-1] == '\n')
     {
         len--;
         str[len] = 0;
@@ -141,7 +273,7 @@ void rtk_prim_add(char *str, struct rtkprim *p, int norm, int prefix)
     
     if(prefix)
     {
-        if(prim[len-1] == '*' || prim[len-1] == '+')
+        if(len && (prim[len-1] == '*' || prim[len-1] == '+'))
         {
             len--;
             prim[len] = 0;
@@ -155,6 +287,14 @@ void rtk_prim_add(char *str, struct rtkprim *p, int norm, int prefix)
         rtk_norm(p->prim[p->count-1], prefix && PREFIX(*p));
 }
 
+void rtk_prim_init(struct rtkprim *p)
+{
+    p->count = 0;
+    p->cap = DEFAULT_CAP;
+    p->prim = malloc(DEFAULT_CAP*sizeof(char**));
+    p->flag = 0;
+}
+
 void rtk_prim_free(struct rtkprim *p)
 {
     int x;
@@ -163,217 +303,3473 @@ void rtk_prim_free(struct rtkprim *p)
     free(p->prim);
 }
 
-int rtk_lookup_init(const char *file)
+int rtk_number(char *str)
+{
+    if(strspn(str, "1234567890") == strlen(str))
+        return atoi(str);
+    return 0;
+}
+
+int rtk_parse(char *line, char **num, char **skip, char **kanji, char **meaning, char **alt, char **kprim)
 {
-    if(!(rtk_dict = fopen(file, "r")))
+    return     !(*num = strtok(line, ":"))
+            || !(*skip = strtok(0, ":"))
+            || !(*kanji = strtok(0, ":"))
+            || !(*meaning = strtok(0, ":"))
+            || !(*alt = strtok(0, ":"))
+            || !(*kprim = strtok(0, ":"))
+            || **kprim == '\n';
+}
+
+int rtk_vocab_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+void rtk_suffix_sort(int *sa, int n, int depth)
+{
+    int x, lt, gt, tmp;
+    unsigned char c, pivot;
+    
+    // three way radix quicksort on the character at depth,
+    // suffixes equal up to the word end need no further order
+    while(n > 1)
     {
-        error("Failed to open kanjifile");
-        return 1;
+        pivot = rtk_strings[sa[n/2]+depth];
+        for(x=0, lt=0, gt=n; x<gt;)
+        {
+            c = rtk_strings[sa[x]+depth];
+            if(c < pivot)
+            {
+                tmp = sa[lt];
+                sa[lt++] = sa[x];
+                sa[x++] = tmp;
+            }
+            else if(c > pivot)
+            {
+                tmp = sa[--gt];
+                sa[gt] = sa[x];
+                sa[x] = tmp;
+            }
+            else
+                x++;
+        }
+        
+        rtk_suffix_sort(sa, lt, depth);
+        rtk_suffix_sort(sa+gt, n-gt, depth);
+        if(!pivot)
+            return;
+        
+        sa += lt;
+        n = gt-lt;
+        depth++;
+    }
+}
+
+void rtk_suffix_index()
+{
+    int x, y;
+    
+    // the words at the start of the pool are each ended by 0,
+    // which sorts before every letter, so a suffix match ends
+    // at a word end
+    rtk_sa = malloc((rtk_text_len ? rtk_text_len : 1)*sizeof(int));
+    for(x=0, rtk_sa_count=0; x<rtk_word_count; x++)
+        for(y=rtk_word_str[x]; rtk_strings[y]; y++)
+            rtk_sa[rtk_sa_count++] = y;
+    rtk_sa = realloc(rtk_sa, (rtk_sa_count ? rtk_sa_count : 1)*sizeof(int));
+    
+    // suffixes starting at a letter in sorted order
+    rtk_suffix_sort(rtk_sa, rtk_sa_count, 0);
+}
+
+int rtk_suffix_word(unsigned int pos)
+{
+    int lo, hi, mid;
+    
+    // the word a suffix lies in, words are laid out in order
+    for(lo=0, hi=rtk_word_count; hi-lo > 1;)
+    {
+        mid = (lo+hi)/2;
+        if(rtk_word_str[mid] <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    
+    return lo;
+}
+
+int rtk_suffix_range(const char *pat, int len, int *first)
+{
+    int lo, hi, mid, end;
+    
+    // suffixes starting with pat
+    for(lo=0, hi=rtk_sa_count; lo<hi;)
+    {
+        mid = (lo+hi)/2;
+        if(strncmp(rtk_strings+rtk_sa[mid], pat, len) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+    
+    for(hi=rtk_sa_count; lo<hi;)
+    {
+        mid = (lo+hi)/2;
+        if(strncmp(rtk_strings+rtk_sa[mid], pat, len) <= 0)
+            lo = mid+1;
+        else
+            hi = mid;
     }
+    end = lo;
     
-    rtk_results = calloc(DEFAULT_CAP, sizeof(struct rtkresult));
-    rtk_result_count = 0;
-    rtk_result_cap = DEFAULT_CAP;
-    rtk_result_allot = 0;
+    return end-*first;
+}
+
+int rtk_letters_cmp(const char *word, const char *str, int len)
+{
+    // primitives are typed without spaces, only the letters of
+    // the word are compared with the first len characters of str
+    for(; len; word++)
+    {
+        if(*word && (*word < 'a' || *word > 'z'))
+            continue;
+        if(*word != *str)
+            return (unsigned char)*word - (unsigned char)*str;
+        str++;
+        len--;
+    }
     
     return 0;
 }
 
-void rtk_result_reset()
+int rtk_letters_len(const char *word)
 {
-    int x;
+    int len = 0;
+    
+    for(; *word; word++)
+        len += *word >= 'a' && *word <= 'z';
+    
+    return len;
+}
+
+int rtk_joined_cmp(const void *a, const void *b)
+{
+    const char *x = rtk_word(*(int*)a), *y = rtk_word(*(int*)b);
     
-    for(x=0; x<rtk_result_count; x++)
+    // by letters, the first of several words with the same ones first
+    for(;; x++, y++)
     {
-        free(rtk_results[x].kanji);
-        free(rtk_results[x].meaning);
+        while(*x && (*x < 'a' || *x > 'z'))
+            x++;
+        while(*y && (*y < 'a' || *y > 'z'))
+            y++;
+        if(*x != *y || !*x)
+            break;
     }
+    if(*x != *y)
+        return (unsigned char)*x - (unsigned char)*y;
     
-    memset(rtk_results, 0, rtk_result_count*sizeof(struct rtkresult));
-    rtk_result_count = 0;
-    rtk_result_allot = 0;
+    return *(int*)a - *(int*)b;
 }
 
-void rtk_lookup_free()
+void rtk_segment_index()
 {
     int x;
     
-    fclose(rtk_dict);
-    rtk_dict = 0;
+    // words of letters only are segmented on the vocabulary itself,
+    // the few with spaces or other characters are sorted by letters
+    rtk_joined_count = 0;
+    rtk_joined = malloc((rtk_word_count ? rtk_word_count : 1)*sizeof(int));
+    for(x=0; x<rtk_word_count; x++)
+        if(strspn(rtk_word(x), "abcdefghijklmnopqrstuvwxyz") != strlen(rtk_word(x)) && rtk_letters_len(rtk_word(x)))
+            rtk_joined[rtk_joined_count++] = x;
+    qsort(rtk_joined, rtk_joined_count, sizeof(int), rtk_joined_cmp);
+    rtk_joined = realloc(rtk_joined, (rtk_joined_count ? rtk_joined_count : 1)*sizeof(int));
+}
+
+int rtk_vocab_search(const char *str, size_t len, int upper)
+{
+    int lo = 0, hi = rtk_word_count, mid, cmp;
+    
+    // first word not ordered before (lower) or after (upper)
+    // str when comparing at most len characters
+    while(lo < hi)
+    {
+        mid = (lo+hi)/2;
+        cmp = strncmp(rtk_word(mid), str, len);
+        if(cmp < 0 || (upper && !cmp))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
     
-    rtk_result_reset();
-    free(rtk_results);
-    rtk_results = 0;
+    return lo;
 }
 
-int rtk_number(char *str)
+unsigned int rtk_hashval(const char *str)
 {
-    if(strspn(str, "1234567890") == strlen(str))
-        return atoi(str);
-    return 0;
+    unsigned int hash = 2166136261u;
+    
+    while(*str)
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    
+    return hash;
 }
 
-struct rtkresult* rtk_lookup(int argc, struct rtkinput *argv)
+void rtk_vocab_index()
 {
-    struct rtkprim *prim, ptmp1, ptmp2;
-    int x, y, z, found, foundpos, lnum, skip, allot;
-    size_t n;
-    char *line, *tmpstr;
-    char *num, *pskip, *kanji, *meaning, *alt, *kprim;
+    int x, slot;
     
-    if(!argc)
-        return 0;
+    // open addressing on the words, exact lookups need no search,
+    // filled to two thirds instead of up to a quarter
+    rtk_word_size = rtk_word_count+rtk_word_count/2+1;
+    rtk_word_hash = malloc(rtk_word_size*sizeof(int));
+    memset(rtk_word_hash, -1, rtk_word_size*sizeof(int));
     
-    prim = malloc((argc)*sizeof(struct rtkprim));
+    for(x=0; x<rtk_word_count; x++)
+    {
+        slot = rtk_hashval(rtk_word(x)) % rtk_word_size;
+        while(rtk_word_hash[slot] != -1)
+            slot = (slot+1) % rtk_word_size;
+        rtk_word_hash[slot] = x;
+    }
+}
+
+int rtk_vocab_find(const char *word)
+{
+    int slot;
     
-    if(rtk_result_count)
-        rtk_result_reset();
+    if(!rtk_word_hash)
+        return -1;
     
-    for(x=0; x<argc; x++)
+    slot = rtk_hashval(word) % rtk_word_size;
+    while(rtk_word_hash[slot] != -1)
     {
-        prim[x].count = 0;
-        prim[x].cap = DEFAULT_CAP;
-        prim[x].prim = malloc(DEFAULT_CAP*sizeof(char**));
-        rtk_prim_add(argv[x].primitive, &prim[x], 1, 1);
-        argv[x].found = 0;
+        if(!strcmp(rtk_word(rtk_word_hash[slot]), word))
+            return rtk_word_hash[slot];
+        slot = (slot+1) % rtk_word_size;
     }
     
-    line = 0;
-    lnum = 0;
-    while(getline(&line, &n, rtk_dict) != -1)
+    return -1;
+}
+
+int rtk_distance(const char *a, const char *b)
+{
+    int row[RTK_WORD_LEN+1], x, y, la, lb, diag, tmp;
+    
+    // levenshtein distance of at most RTK_WORD_LEN characters
+    la = strlen(a);
+    lb = strlen(b);
+    if(la > RTK_WORD_LEN)
+        la = RTK_WORD_LEN;
+    if(lb > RTK_WORD_LEN)
+        lb = RTK_WORD_LEN;
+    
+    for(y=0; y<=lb; y++)
+        row[y] = y;
+    
+    for(x=1; x<=la; x++)
     {
-        lnum++;
-        
-        if(*line == '\n' || *line == '#')
-            continue;
-        if(    !(num = strtok(line, ":"))
-            || !(pskip = strtok(0, ":"))
-            || !(kanji = strtok(0, ":"))
-            || !(meaning = strtok(0, ":"))
-            || !(alt = strtok(0, ":"))
-            || !(kprim = strtok(0, ":"))
-            || *kprim == '\n')
-        {
-            warn("failed to parse line %i\n", lnum);
-            continue;
-        }
-        
-        ptmp1.count = 0;
-        ptmp1.cap = DEFAULT_CAP;
-        ptmp1.prim = malloc(DEFAULT_CAP*sizeof(char**));
-        
-        // create list of meaning and alternative meanings
-        rtk_prim_add(meaning, &ptmp1, 1, 0);
-        tmpstr = strtok(alt, "/");
-        while(tmpstr && (tmpstr[0] != '-' || tmpstr[1]))
-        {
-            rtk_prim_add(tmpstr, &ptmp1, 1, 0);
-            tmpstr = strtok(0, "/");
-        }
-        
-        // ignore meaning/alternatives
-        skip = rtk_number(pskip);
-        
-        // for every user entered primitive
-        // if the primitive is found in the meaning or alt meanings
-        // add those except the one found to the respective
-        // primitive list
-        found = allot = 0;
-        foundpos = -1;
-        for(x=0; x<argc; x++)
-        {
-            prim[x].flag &= ~FLAG_FOUND;
-            
-            for(z=0; z<ptmp1.count; z++)
-                if((!PREFIX(prim[x]) && !strcmp(prim[x].prim[0], ptmp1.prim[z]))
-                    || (PREFIX(prim[x]) && !strncmp(prim[x].prim[0], ptmp1.prim[z], strlen(prim[x].prim[0]))))
-                {
-                    found++;
-                    allot = 1;
-                    argv[x].found = 1;
-                    prim[x].flag |= FLAG_FOUND;
-                    
-                    // only add if found meaning/alt not skipped
-                    // and add only those which are not skipped
-                    if(found == 1 && z >= skip)
-                    {
-                        foundpos = z;
-                        for(z=skip; z<ptmp1.count; z++)
-                            if(z != foundpos)
-                                rtk_prim_add(ptmp1.prim[z], &prim[x], 0, 0);
-                    }
-                    break;
-                }
-        }
-        
-        // continue if no sub primitives
-        if(kprim[0] == '-' && kprim[1] == '\n')
-        {
-            if(found == argc && rtk_number(num))
-                rtk_result_add(atoi(num), kanji, meaning, allot);
-            
-            rtk_prim_free(&ptmp1);
-            continue;
-        }
-        
-        // create list of sub primitives
-        ptmp2.count = 0;
-        ptmp2.cap = DEFAULT_CAP;
-        ptmp2.prim = malloc(DEFAULT_CAP*sizeof(char**));
-        tmpstr = strtok(kprim, "/");
-        while(tmpstr)
-        {
-            rtk_prim_add(tmpstr, &ptmp2, 1, 0);
-            tmpstr = strtok(0, "/");
-        }
-        
-        // for every user entered primitive
-        // if one of the respective primitive list matches one out
-        // of the current list of sub primitives
-        // add meaning and alt meaning of the current kanji to the
-        // respective primitive list
-        found = 0;
-        for(x=0; x<argc; x++)
+        diag = row[0];
+        row[0] = x;
+        for(y=1; y<=lb; y++)
         {
-            for(y=0; y<prim[x].count; y++)
-                for(z=0; z<ptmp2.count; z++)
-                    if((!PREFIX(prim[x]) && !strcmp(prim[x].prim[y], ptmp2.prim[z]))
-                        || (PREFIX(prim[x]) && !strncmp(prim[x].prim[y], ptmp2.prim[z], strlen(prim[x].prim[y]))))
-                    {
-                        found++;
-                        y = prim[x].count;
-                        z = -1;
-                        break;
-                    }
-            if(z == -1)
-            {
-                // skip meaning/alt if already defined as primitive/alt
-                for(z=skip; z<ptmp1.count; z++)
-                    rtk_prim_add(ptmp1.prim[z], &prim[x], 0, 0);
-            }
-            // mark found if meaning == user entered primitive
-            else if(prim[x].flag & FLAG_FOUND)
-                found++;
+            tmp = row[y];
+            row[y] = diag + (a[x-1] != b[y-1]);
+            if(row[y] > row[y-1]+1)
+                row[y] = row[y-1]+1;
+            if(row[y] > tmp+1)
+                row[y] = tmp+1;
+            diag = tmp;
         }
-        
-        // if for every primitve list a matching one is found
-        // and the current kanji is not numberless
-        if(found >= argc && rtk_number(num))
-            rtk_result_add(atoi(num), kanji, meaning, allot);
-        
-        rtk_prim_free(&ptmp1);
-        rtk_prim_free(&ptmp2);
     }
     
-    for(x=0; x<argc; x++)
-        rtk_prim_free(&prim[x]);
+    return row[lb];
+}
+
+void rtk_bktree_add(int word)
+{
+    int node = 0, x, dist;
     
-    free(prim);
-    free(line);
+    rtk_bktree[word].child = rtk_bktree[word].next = -1;
+    rtk_bktree[word].dist = 0;
     
-    fseek(rtk_dict, 0, SEEK_SET);
+    if(!word)
+        return;
     
-    if(!rtk_result_count)
-        return 0;
-    return rtk_results;
+    while(1)
+    {
+        dist = rtk_distance(rtk_word(word), rtk_word(node));
+        for(x=rtk_bktree[node].child; x != -1 && rtk_bktree[x].dist != dist; x=rtk_bktree[x].next);
+        if(x == -1)
+            break;
+        node = x;
+    }
+    
+    rtk_bktree[word].dist = dist;
+    rtk_bktree[word].next = rtk_bktree[node].child;
+    rtk_bktree[node].child = word;
+}
+
+void rtk_bktree_index()
+{
+    int x;
+    
+    // node x for word x, built with the suffix array so the first
+    // correction does not pay for it
+    rtk_bktree = malloc((rtk_word_count ? rtk_word_count : 1)*sizeof(struct rtkbktree));
+    for(x=0; x<rtk_word_count; x++)
+        rtk_bktree_add(x);
+}
+
+void rtk_closure_add(int word, int *stamp, int mark, int *list, int *count)
+{
+    if(word == -1 || stamp[word] == mark)
+        return;
+    stamp[word] = mark;
+    list[(*count)++] = word;
+}
+
+int rtk_int_cmp(const void *a, const void *b)
+{
+    return *(int*)a - *(int*)b;
+}
+
+void rtk_times_add(int word, int times, int from, int mark, int *stamp, int *max, int *pred, int *list, int *count)
+{
+    if(word == -1)
+        return;
+    if(stamp[word] != mark)
+    {
+        stamp[word] = mark;
+        max[word] = 0;
+        pred[word] = from;
+        list[(*count)++] = word;
+    }
+    if(times > max[word])
+        max[word] = times;
+}
+
+int rtk_varint(unsigned char *buf, unsigned int val)
+{
+    int len = 0;
+    
+    // seven bits per byte, the high bit continues
+    while(val >= 0x80)
+    {
+        if(buf)
+            buf[len] = val | 0x80;
+        len++;
+        val >>= 7;
+    }
+    if(buf)
+        buf[len] = val;
+    
+    return len+1;
+}
+
+unsigned int rtk_varint_get(const unsigned char **buf)
+{
+    unsigned int val = 0;
+    int shift = 0;
+    
+    while(**buf & 0x80)
+    {
+        val |= (*(*buf)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    
+    return val | *(*buf)++ << shift;
+}
+
+int rtk_contain_encode(unsigned char *buf, const int *words, const unsigned char *times, const int *preds, int count)
+{
+    int x, len, delta, bitmap, except;
+    
+    // sorted words as deltas or as bitmap from the first word,
+    // whichever is smaller, followed by the times not being one
+    // and the distance to the entry every word was reached by
+    for(x=1, delta=0; x<count; x++)
+        delta += rtk_varint(0, words[x]-words[x-1]);
+    bitmap = count ? (words[count-1]-words[0])/8+1 : 0;
+    
+    len = rtk_varint(buf, count << 1 | (bitmap < delta));
+    if(!count)
+        return len;
+    len += rtk_varint(buf ? buf+len : 0, words[0]);
+    
+    if(bitmap < delta)
+    {
+        if(buf)
+        {
+            memset(buf+len, 0, bitmap);
+            for(x=0; x<count; x++)
+                buf[len+(words[x]-words[0])/8] |= 1 << (words[x]-words[0])%8;
+        }
+        len += bitmap;
+    }
+    else
+        for(x=1; x<count; x++)
+            len += rtk_varint(buf ? buf+len : 0, words[x]-words[x-1]);
+    
+    for(x=0, except=0; x<count; x++)
+        except += times[x] != 1;
+    len += rtk_varint(buf ? buf+len : 0, except);
+    for(x=0; x<count; x++)
+        if(times[x] != 1)
+        {
+            len += rtk_varint(buf ? buf+len : 0, x);
+            if(buf)
+                buf[len] = times[x];
+            len++;
+        }
+    
+    for(x=0; x<count; x++)
+        len += rtk_varint(buf ? buf+len : 0, preds[x]);
+    
+    return len;
+}
+
+int rtk_contains(struct rtkcontext *c, int e, int **words, unsigned char **times, int **preds)
+{
+    const unsigned char *buf = rtk_contain+rtk_contain_start[e];
+    unsigned int head, count, first, x, bit, except;
+    
+    // decoded into buffers shared by all entries,
+    // predecessors only when explaining
+    *words = c->decode;
+    *times = c->decode_times;
+    if(preds)
+        *preds = c->decode_pred;
+    
+    head = rtk_varint_get(&buf);
+    if(!(count = head >> 1))
+        return 0;
+    
+    first = c->decode[0] = rtk_varint_get(&buf);
+    if(head & 1)
+    {
+        for(x=1, bit=1; x<count; bit++)
+            if(buf[bit/8] & 1 << bit%8)
+                c->decode[x++] = first+bit;
+        buf += (c->decode[count-1]-first)/8+1;
+    }
+    else
+        for(x=1; x<count; x++)
+            c->decode[x] = c->decode[x-1]+rtk_varint_get(&buf);
+    
+    memset(c->decode_times, 1, count);
+    for(except=rtk_varint_get(&buf); except; except--)
+    {
+        x = rtk_varint_get(&buf);
+        c->decode_times[x] = *buf++;
+    }
+    
+    if(preds)
+        for(x=0; x<count; x++)
+            c->decode_pred[x] = e-rtk_varint_get(&buf);
+    
+    return count;
+}
+
+void rtk_closure_init(struct rtkclosure *cl, int slots)
+{
+    int x, y, words = rtk_word_count;
+    
+    // entries defining a word as meaning or not skipped alternative
+    cl->def_start = calloc(words+1, sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+        for(y=rtk_name_start[x]+rtk_skip[x]; y<rtk_name_start[x+1]; y++)
+            if(rtk_names[y] != -1)
+                cl->def_start[rtk_names[y]+1]++;
+    for(x=0; x<words; x++)
+        cl->def_start[x+1] += cl->def_start[x];
+    
+    cl->defs = malloc((cl->def_start[words] ? cl->def_start[words] : 1)*sizeof(int));
+    cl->pos = malloc((words ? words : 1)*sizeof(int));
+    memcpy(cl->pos, cl->def_start, words*sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+        for(y=rtk_name_start[x]+rtk_skip[x]; y<rtk_name_start[x+1]; y++)
+            if(rtk_names[y] != -1)
+                cl->defs[cl->pos[rtk_names[y]]++] = x;
+    
+    cl->stamp = calloc(words ? words : 1, sizeof(int));
+    cl->list = malloc((words ? words : 1)*sizeof(int));
+    cl->total = malloc((words ? words : 1)*sizeof(int));
+    cl->pstamp = calloc(words ? words : 1, sizeof(int));
+    cl->pmax = malloc((words ? words : 1)*sizeof(int));
+    cl->plist = malloc((words ? words : 1)*sizeof(int));
+    cl->pred = malloc((words ? words : 1)*sizeof(int));
+    cl->ppred = malloc((words ? words : 1)*sizeof(int));
+    cl->pmark = 0;
+    
+    // closures computed now are kept in slots,
+    // entries without one are decoded from the index
+    cl->slot = 0;
+    cl->cstart = malloc((slots+1)*sizeof(int));
+    cl->ccap = DEFAULT_CAP*DEFAULT_CAP;
+    cl->cwords = malloc(cl->ccap*sizeof(int));
+    cl->ctimes = malloc(cl->ccap);
+    cl->cpred = malloc(cl->ccap*sizeof(int));
+    cl->cstart[0] = 0;
+}
+
+void rtk_closure_free(struct rtkclosure *cl)
+{
+    free(cl->def_start);
+    free(cl->defs);
+    free(cl->pos);
+    free(cl->stamp);
+    free(cl->list);
+    free(cl->total);
+    free(cl->pstamp);
+    free(cl->pmax);
+    free(cl->plist);
+    free(cl->pred);
+    free(cl->ppred);
+    free(cl->slot);
+    free(cl->cstart);
+    free(cl->cwords);
+    free(cl->ctimes);
+    free(cl->cpred);
+}
+
+void rtk_closure_defs(struct rtkclosure *cl)
+{
+    int x;
+    
+    // first entry defining every word, for decompositions
+    for(x=0; x<rtk_word_count; x++)
+        rtk_word_def[x] = cl->def_start[x] < cl->def_start[x+1] ? cl->defs[cl->def_start[x]] : -1;
+}
+
+int rtk_closure_get(struct rtkclosure *cl, int f, int **words, unsigned char **times)
+{
+    int s = cl->slot ? cl->slot[f] : f;
+    
+    if(s == -1)
+        return rtk_contains(&rtk_context, f, words, times, 0);
+    
+    *words = cl->cwords+cl->cstart[s];
+    *times = cl->ctimes+cl->cstart[s];
+    return cl->cstart[s+1]-cl->cstart[s];
+}
+
+void rtk_closure_entry(struct rtkclosure *cl, int x, int s)
+{
+    int *words, y, z, d, f, p, w, count, pcount, fcount;
+    unsigned char *times;
+    
+    // the words an entry contains are its primitives and everything
+    // earlier entries defining one of them contain or are named,
+    // just like the scan in rtk_lookup_scan collects them line by line
+    // every primitive adds the times it contains a word, alternative
+    // definitions of the same primitive count once
+    count = 0;
+    for(y=rtk_prim_start[x]; y<rtk_prim_start[x+1]; y++)
+    {
+        if((p = rtk_prims[y]) == -1)
+            continue;
+        pcount = 0;
+        cl->pmark++;
+        rtk_times_add(p, 1, x, cl->pmark, cl->pstamp, cl->pmax, cl->ppred, cl->plist, &pcount);
+        for(d=cl->def_start[p]; d<cl->def_start[p+1] && cl->defs[d] < x; d++)
+        {
+            f = cl->defs[d];
+            fcount = rtk_closure_get(cl, f, &words, &times);
+            for(z=0; z<fcount; z++)
+                rtk_times_add(words[z], times[z], f, cl->pmark, cl->pstamp, cl->pmax, cl->ppred, cl->plist, &pcount);
+            for(z=rtk_name_start[f]+rtk_skip[f]; z<rtk_name_start[f+1]; z++)
+                rtk_times_add(rtk_names[z], 1, f, cl->pmark, cl->pstamp, cl->pmax, cl->ppred, cl->plist, &pcount);
+        }
+        for(z=0; z<pcount; z++)
+        {
+            w = cl->plist[z];
+            if(cl->stamp[w] != x+1)
+            {
+                cl->total[w] = 0;
+                cl->pred[w] = cl->ppred[w];
+            }
+            rtk_closure_add(w, cl->stamp, x+1, cl->list, &count);
+            cl->total[w] += cl->pmax[w];
+        }
+    }
+    qsort(cl->list, count, sizeof(int), rtk_int_cmp);
+    
+    if(cl->cstart[s]+count > cl->ccap)
+    {
+        while(cl->cstart[s]+count > cl->ccap)
+            cl->ccap *= 2;
+        cl->cwords = realloc(cl->cwords, cl->ccap*sizeof(int));
+        cl->ctimes = realloc(cl->ctimes, cl->ccap);
+        cl->cpred = realloc(cl->cpred, cl->ccap*sizeof(int));
+    }
+    memcpy(cl->cwords+cl->cstart[s], cl->list, count*sizeof(int));
+    for(y=0; y<count; y++)
+    {
+        cl->ctimes[cl->cstart[s]+y] = cl->total[cl->list[y]] > 255 ? 255 : cl->total[cl->list[y]];
+        cl->cpred[cl->cstart[s]+y] = x-cl->pred[cl->list[y]];
+    }
+    cl->cstart[s+1] = cl->cstart[s]+count;
+}
+
+void rtk_closure()
+{
+    struct rtkclosure cl;
+    int *stamp, *list, *pos, *cstart, *cwords, *cpred;
+    unsigned char *ctimes;
+    int x, y, len, count, words = rtk_word_count;
+    
+    rtk_closure_init(&cl, rtk_entry_count);
+    rtk_word_def = malloc((words ? words : 1)*sizeof(int));
+    rtk_closure_defs(&cl);
+    
+    for(x=0; x<rtk_entry_count; x++)
+        rtk_closure_entry(&cl, x, x);
+    
+    stamp = cl.stamp;
+    list = cl.list;
+    pos = cl.pos;
+    cstart = cl.cstart;
+    cwords = cl.cwords;
+    ctimes = cl.ctimes;
+    cpred = cl.cpred;
+    
+    // invert into candidate sets per word, entries being named
+    // by the word or containing it in dictionary order
+    rtk_post_start = calloc(words+1, sizeof(int));
+    memset(stamp, 0, words*sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+    {
+        count = 0;
+        for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+            rtk_closure_add(rtk_names[y], stamp, x+1, list, &count);
+        for(y=cstart[x]; y<cstart[x+1]; y++)
+            rtk_closure_add(cwords[y], stamp, x+1, list, &count);
+        for(y=0; y<count; y++)
+            rtk_post_start[list[y]+1]++;
+    }
+    for(x=0; x<words; x++)
+        rtk_post_start[x+1] += rtk_post_start[x];
+    
+    rtk_posts = malloc((rtk_post_start[words] ? rtk_post_start[words] : 1)*sizeof(int));
+    memcpy(pos, rtk_post_start, words*sizeof(int));
+    memset(stamp, 0, words*sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+    {
+        count = 0;
+        for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+            rtk_closure_add(rtk_names[y], stamp, x+1, list, &count);
+        for(y=cstart[x]; y<cstart[x+1]; y++)
+            rtk_closure_add(cwords[y], stamp, x+1, list, &count);
+        for(y=0; y<count; y++)
+            rtk_posts[pos[list[y]]++] = x;
+    }
+    
+    // the contained words are only needed for multiplicities,
+    // kept encoded per entry
+    rtk_contain_start = malloc((rtk_entry_count+1)*sizeof(int));
+    for(x=0, len=0, rtk_contain_max=1; x<rtk_entry_count; x++)
+    {
+        count = cstart[x+1]-cstart[x];
+        if(count > rtk_contain_max)
+            rtk_contain_max = count;
+        rtk_contain_start[x] = len;
+        len += rtk_contain_encode(0, cwords+cstart[x], ctimes+cstart[x], cpred+cstart[x], count);
+    }
+    rtk_contain_start[rtk_entry_count] = len;
+    
+    rtk_contain = malloc(len ? len : 1);
+    for(x=0; x<rtk_entry_count; x++)
+        rtk_contain_encode(rtk_contain+rtk_contain_start[x], cwords+cstart[x],
+            ctimes+cstart[x], cpred+cstart[x], cstart[x+1]-cstart[x]);
+    
+    rtk_closure_free(&cl);
+}
+
+int rtk_name_first(int e, int name)
+{
+    int x;
+    
+    if(rtk_names[name] == -1)
+        return 0;
+    for(x=rtk_name_start[e]; x<name; x++)
+        if(rtk_names[x] == rtk_names[name])
+            return 0;
+    return 1;
+}
+
+void rtk_frame_index()
+{
+    int *pos, x, y, words = rtk_word_count;
+    unsigned int frames;
+    
+    // entry of every frame number
+    for(x=0, frames=1; x<rtk_entry_count; x++)
+        if(rtk_numbers[x] >= frames)
+            frames = rtk_numbers[x]+1;
+    rtk_frame_count = frames;
+    rtk_frames = malloc(rtk_frame_count*sizeof(int));
+    memset(rtk_frames, -1, rtk_frame_count*sizeof(int));
+    for(x=rtk_entry_count-1; x>=0; x--)
+        if(rtk_numbers[x])
+            rtk_frames[rtk_numbers[x]] = x;
+    
+    // numbered entries named by every word
+    rtk_named_start = calloc(words+1, sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+        for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+            if(rtk_numbers[x] && rtk_name_first(x, y))
+                rtk_named_start[rtk_names[y]+1]++;
+    for(x=0; x<words; x++)
+        rtk_named_start[x+1] += rtk_named_start[x];
+    
+    rtk_named = malloc((rtk_named_start[words] ? rtk_named_start[words] : 1)*sizeof(int));
+    pos = malloc((words ? words : 1)*sizeof(int));
+    memcpy(pos, rtk_named_start, words*sizeof(int));
+    for(x=0; x<rtk_entry_count; x++)
+        for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+            if(rtk_numbers[x] && rtk_name_first(x, y))
+                rtk_named[pos[rtk_names[y]]++] = x;
+    free(pos);
+}
+
+void rtk_kanji_index()
+{
+    int x, slot, count;
+    
+    // open addressing on the kanji field, the first entry wins
+    // entries without a kanji glyph are left out, filled to
+    // two thirds by the entries having one
+    for(x=0, count=0; x<rtk_entry_count; x++)
+        count += ((unsigned char)*rtk_string(rtk_kanji[x]) & 0x80) != 0;
+    rtk_kanji_size = count+count/2+1;
+    rtk_kanji_hash = malloc(rtk_kanji_size*sizeof(int));
+    memset(rtk_kanji_hash, -1, rtk_kanji_size*sizeof(int));
+    
+    for(x=0; x<rtk_entry_count; x++)
+    {
+        if(!((unsigned char)*rtk_string(rtk_kanji[x]) & 0x80))
+            continue;
+        
+        slot = rtk_hashval(rtk_string(rtk_kanji[x])) % rtk_kanji_size;
+        while(rtk_kanji_hash[slot] != -1 && rtk_kanji[rtk_kanji_hash[slot]] != rtk_kanji[x]
+                && strcmp(rtk_string(rtk_kanji[rtk_kanji_hash[slot]]), rtk_string(rtk_kanji[x])))
+            slot = (slot+1) % rtk_kanji_size;
+        if(rtk_kanji_hash[slot] == -1)
+            rtk_kanji_hash[slot] = x;
+    }
+}
+
+int rtk_kanji_find(const char *kanji)
+{
+    int slot;
+    
+    if(!rtk_kanji_hash)
+        return -1;
+    
+    slot = rtk_hashval(kanji) % rtk_kanji_size;
+    while(rtk_kanji_hash[slot] != -1)
+    {
+        if(!strcmp(rtk_string(rtk_kanji[rtk_kanji_hash[slot]]), kanji))
+            return rtk_kanji_hash[slot];
+        slot = (slot+1) % rtk_kanji_size;
+    }
+    
+    return -1;
+}
+
+int rtk_kanji_cmp(const void *a, const void *b)
+{
+    return strcmp(rtk_string(rtk_kanji[*(int*)a]), rtk_string(rtk_kanji[*(int*)b]));
+}
+
+char* rtk_freq_path(int layer)
+{
+    const char *dict = rtk_layers[layer].file, *slash;
+    char *path;
+    int x, len;
+    
+    // the optional frequency table lives next to a layer,
+    // layers in one directory share it
+    slash = strrchr(dict, '/');
+    len = slash ? slash-dict+1 : 0;
+    for(x=0; x<layer; x++)
+        if(!strncmp(rtk_layers[x].file, dict, len) && !strchr(rtk_layers[x].file+len, '/'))
+            return 0;
+    
+    path = malloc(len+sizeof(FREQ_FILE));
+    memcpy(path, dict, len);
+    strcpy(path+len, FREQ_FILE);
+    
+    return path;
+}
+
+void rtk_freq_load()
+{
+    FILE *file;
+    char *path, *line, *kanji, *count;
+    int *ids, x, l, lo, hi, mid;
+    unsigned int freq;
+    double start = rtk_clock();
+    size_t n;
+    
+    // every line holds a kanji followed by its count in some corpus,
+    // tables of later layers override the counts of earlier ones
+    memset(rtk_freq, 0, rtk_entry_count*sizeof(int));
+    ids = 0;
+    line = 0;
+    
+    for(l=0; l<rtk_layer_count; l++)
+    {
+        if(!(path = rtk_freq_path(l)))
+            continue;
+        file = fopen(path, "r");
+        free(path);
+        if(!file)
+            continue;
+        
+        // entries sorted by kanji, numberless ones may share it
+        if(!ids)
+        {
+            ids = malloc((rtk_entry_count ? rtk_entry_count : 1)*sizeof(int));
+            for(x=0; x<rtk_entry_count; x++)
+                ids[x] = x;
+            qsort(ids, rtk_entry_count, sizeof(int), rtk_kanji_cmp);
+        }
+        
+        while(getline(&line, &n, file) != -1)
+        {
+            if(*line == '#')
+                continue;
+            if(!(kanji = strtok(line, " \t\n")) || !(count = strtok(0, " \t\n")))
+                continue;
+            
+            freq = strtoul(count, 0, 10);
+            for(lo=0, hi=rtk_entry_count; lo<hi;)
+            {
+                mid = (lo+hi)/2;
+                if(strcmp(rtk_string(rtk_kanji[ids[mid]]), kanji) < 0)
+                    lo = mid+1;
+                else
+                    hi = mid;
+            }
+            for(; lo<rtk_entry_count && !strcmp(rtk_string(rtk_kanji[ids[lo]]), kanji); lo++)
+                rtk_freq[ids[lo]] = freq;
+        }
+        fclose(file);
+    }
+    
+    free(line);
+    free(ids);
+    rtk_phase_ms[PHASE_FREQ] = rtk_clock()-start;
+}
+
+int rtk_string_add(const char *str, int len)
+{
+    int off = rtk_string_len;
+    
+    if(rtk_string_len+len+1 > rtk_string_cap)
+    {
+        rtk_string_cap = 2*(rtk_string_len+len+1);
+        rtk_strings = realloc(rtk_strings, rtk_string_cap);
+    }
+    memcpy(rtk_strings+off, str, len);
+    rtk_strings[off+len] = 0;
+    rtk_string_len += len+1;
+    
+    return off;
+}
+
+void rtk_word_add(const char *str, int **list, int *count, int *cap)
+{
+    int off = rtk_string_add(str, strcspn(str, "\n"));
+    
+    if(*count == *cap)
+    {
+        *cap = *cap ? 2**cap : DEFAULT_CAP*DEFAULT_CAP;
+        *list = realloc(*list, *cap*sizeof(int));
+    }
+    
+    // empty words are kept to not shift the skipped names
+    rtk_norm(rtk_strings+off, 0);
+    (*list)[(*count)++] = rtk_strings[off] ? off : -1;
+}
+
+void rtk_entry_grow(int cap)
+{
+    rtk_numbers = realloc(rtk_numbers, cap*sizeof(int));
+    rtk_freq = realloc(rtk_freq, cap*sizeof(int));
+    rtk_kanji = realloc(rtk_kanji, cap*sizeof(int));
+    rtk_meaning = realloc(rtk_meaning, cap*sizeof(int));
+    rtk_skip = realloc(rtk_skip, cap);
+    rtk_name_start = realloc(rtk_name_start, (cap+1)*sizeof(int));
+    rtk_prim_start = realloc(rtk_prim_start, (cap+1)*sizeof(int));
+}
+
+unsigned int rtk_string_intern(const char *str, int *hash, int mask, char *pool, int *len)
+{
+    int slot = rtk_hashval(str) & mask;
+    
+    while(hash[slot] != -1 && strcmp(pool+hash[slot], str))
+        slot = (slot+1) & mask;
+    
+    if(hash[slot] == -1)
+    {
+        hash[slot] = *len;
+        strcpy(pool+*len, str);
+        *len += strlen(str)+1;
+    }
+    
+    return hash[slot];
+}
+
+void rtk_unparsable_add(char *line, int len, int index)
+{
+    int x;
+    
+    // strtok left the line split at the colons it got to
+    for(x=0; x<len; x++)
+        if(!line[x])
+            line[x] = ':';
+    if(len && line[len-1] == '\n')
+        line[len-1] = 0;
+    
+    if(rtk_unparsable_count == rtk_unparsable_cap)
+    {
+        rtk_unparsable_cap += DEFAULT_CAP;
+        rtk_unparsable = realloc(rtk_unparsable, rtk_unparsable_cap*sizeof(char*));
+        rtk_unparsable_line = realloc(rtk_unparsable_line, rtk_unparsable_cap*sizeof(int));
+    }
+    rtk_unparsable_line[rtk_unparsable_count] = index;
+    rtk_unparsable[rtk_unparsable_count++] = strdup(line);
+}
+
+char* rtk_merge_line(struct rtkmerge *m, int x, char **line, int *cap)
+{
+    // parsing splits a copy ending like a line of the file
+    if(m->lens[x]+2 > *cap)
+    {
+        *cap = 2*(m->lens[x]+2);
+        *line = realloc(*line, *cap);
+    }
+    memcpy(*line, m->lines[x], m->lens[x]);
+    (*line)[m->lens[x]] = '\n';
+    (*line)[m->lens[x]+1] = 0;
+    
+    return *line;
+}
+
+void rtk_dict_load(struct rtkmerge *m)
+{
+    char *line, *tmpstr, *tmp, **words;
+    char *num, *pskip, *kanji, *meaning, *alt, *kprim;
+    int *hash, x, y, l, mask, slot, skip, cap, name_count, name_cap, prim_count, prim_cap, len, linecap;
+    double start;
+    
+    // read every line into parallel arrays, the strings and lists
+    // of normalized names (meaning and alternatives) and primitives
+    // are offsets into a temporary pool for now
+    start = rtk_clock();
+    cap = name_count = name_cap = prim_count = prim_cap = linecap = 0;
+    line = 0;
+    
+    // reloads compare the lines, entries follow them in order
+    // leaving out the unparsable ones
+    rtk_line_count = m->count;
+    rtk_line_hash = m->hashes;
+    m->hashes = 0;
+    
+    for(l=0; l<m->count; l++)
+    {
+        if(rtk_parse(rtk_merge_line(m, l, &line, &linecap), &num, &pskip, &kanji, &meaning, &alt, &kprim))
+        {
+            warn("failed to parse line %i\n", m->nums[l]);
+            rtk_unparsable_add(line, m->lens[l]+1, l);
+            continue;
+        }
+        
+        if(rtk_entry_count == cap)
+        {
+            cap = cap ? 2*cap : DEFAULT_CAP*DEFAULT_CAP;
+            rtk_entry_grow(cap);
+        }
+        
+        x = rtk_entry_count++;
+        rtk_numbers[x] = rtk_number(num);
+        rtk_freq[x] = 0;
+        rtk_kanji[x] = rtk_string_add(kanji, strlen(kanji));
+        rtk_meaning[x] = rtk_string_add(meaning, strlen(meaning));
+        rtk_name_start[x] = name_count;
+        rtk_prim_start[x] = prim_count;
+        skip = rtk_number(pskip);
+        
+        rtk_word_add(meaning, &rtk_names, &name_count, &name_cap);
+        tmpstr = strtok(alt, "/");
+        while(tmpstr && (tmpstr[0] != '-' || tmpstr[1]))
+        {
+            rtk_word_add(tmpstr, &rtk_names, &name_count, &name_cap);
+            tmpstr = strtok(0, "/");
+        }
+        rtk_skip[x] = skip < name_count-rtk_name_start[x] ? skip : name_count-rtk_name_start[x];
+        
+        if(kprim[0] == '-' && kprim[1] == '\n')
+            continue;
+        
+        tmpstr = strtok(kprim, "/");
+        while(tmpstr)
+        {
+            rtk_word_add(tmpstr, &rtk_prims, &prim_count, &prim_cap);
+            tmpstr = strtok(0, "/");
+        }
+    }
+    
+    free(line);
+    rtk_phase_ms[PHASE_PARSE] = rtk_clock()-start;
+    start = rtk_clock();
+    
+    if(!cap)
+        rtk_entry_grow(1);
+    rtk_name_start[rtk_entry_count] = name_count;
+    rtk_prim_start[rtk_entry_count] = prim_count;
+    
+    // collect the vocabulary of all names and primitives,
+    // duplicates are dropped before sorting
+    tmp = rtk_strings;
+    for(mask=1; mask < 2*(name_count+prim_count+2*rtk_entry_count); mask <<= 1);
+    hash = malloc(mask*sizeof(int));
+    memset(hash, -1, mask*sizeof(int));
+    mask--;
+    
+    words = malloc((name_count+prim_count+1)*sizeof(char*));
+    for(x=0; x<name_count+prim_count; x++)
+    {
+        if((y = x < name_count ? rtk_names[x] : rtk_prims[x-name_count]) == -1)
+            continue;
+        
+        slot = rtk_hashval(tmp+y) & mask;
+        while(hash[slot] != -1 && strcmp(tmp+hash[slot], tmp+y))
+            slot = (slot+1) & mask;
+        if(hash[slot] != -1)
+            continue;
+        
+        hash[slot] = y;
+        words[rtk_word_count++] = tmp+y;
+    }
+    
+    qsort(words, rtk_word_count, sizeof(char*), rtk_vocab_cmp);
+    
+    // the pool starts with the sorted words for the suffix array,
+    // kanji and meanings follow and share equal strings
+    rtk_strings = malloc(rtk_string_len+1);
+    rtk_word_str = malloc((rtk_word_count ? rtk_word_count : 1)*sizeof(int));
+    memset(hash, -1, (mask+1)*sizeof(int));
+    for(x=0, len=0; x<rtk_word_count; x++)
+        rtk_word_str[x] = rtk_string_intern(words[x], hash, mask, rtk_strings, &len);
+    rtk_text_len = len;
+    rtk_vocab_index();
+    
+    // replace the lists of every entry by word ids
+    for(x=0; x<name_count; x++)
+        if(rtk_names[x] != -1)
+            rtk_names[x] = rtk_vocab_find(tmp+rtk_names[x]);
+    for(x=0; x<prim_count; x++)
+        if(rtk_prims[x] != -1)
+            rtk_prims[x] = rtk_vocab_find(tmp+rtk_prims[x]);
+    
+    for(x=0; x<rtk_entry_count; x++)
+    {
+        rtk_kanji[x] = rtk_string_intern(tmp+rtk_kanji[x], hash, mask, rtk_strings, &len);
+        rtk_meaning[x] = rtk_string_intern(tmp+rtk_meaning[x], hash, mask, rtk_strings, &len);
+    }
+    
+    free(tmp);
+    free(words);
+    free(hash);
+    
+    // everything is sized to fit once loaded
+    rtk_strings = realloc(rtk_strings, len ? len : 1);
+    rtk_string_len = rtk_string_cap = len;
+    rtk_entry_grow(rtk_entry_count ? rtk_entry_count : 1);
+    rtk_names = realloc(rtk_names, (name_count ? name_count : 1)*sizeof(int));
+    rtk_prims = realloc(rtk_prims, (prim_count ? prim_count : 1)*sizeof(int));
+    rtk_phase_ms[PHASE_VOCAB] = rtk_clock()-start;
+    
+    start = rtk_clock();
+    rtk_suffix_index();
+    rtk_phase_ms[PHASE_SUFFIX] = rtk_clock()-start;
+    start = rtk_clock();
+    rtk_bktree_index();
+    rtk_phase_ms[PHASE_BKTREE] = rtk_clock()-start;
+    start = rtk_clock();
+    rtk_closure();
+    rtk_phase_ms[PHASE_CLOSURE] = rtk_clock()-start;
+    start = rtk_clock();
+    rtk_kanji_index();
+    rtk_frame_index();
+    rtk_phase_ms[PHASE_KANJI] = rtk_clock()-start;
+    
+    start = rtk_clock();
+    rtk_segment_index();
+    rtk_phase_ms[PHASE_SEGMENT] = rtk_clock()-start;
+}
+
+char* rtk_layer_key(char *line, int len, int *keylen)
+{
+    char *colon, *kanji, *end;
+    
+    // deletions name the key directly, meanings may contain spaces
+    if(*line == '!')
+    {
+        for(*keylen=len-1; *keylen && (line[*keylen] == ' ' || line[*keylen] == '\t'); (*keylen)--);
+        return line+1;
+    }
+    
+    // numbered entries are keyed by number, the others by kanji
+    // and those without kanji by meaning
+    if(!(colon = memchr(line, ':', len))
+            || !(kanji = memchr(colon+1, ':', line+len-colon-1))
+            || !(end = memchr(kanji+1, ':', line+len-kanji-1)))
+        return 0;
+    kanji++;
+    
+    if(*line != '0' && strspn(line, "1234567890") == (size_t)(colon-line))
+    {
+        *keylen = colon-line;
+        return line;
+    }
+    
+    if(end-kanji == 1 && *kanji == '-')
+    {
+        kanji = end+1;
+        if(!(end = memchr(kanji, ':', line+len-kanji)))
+            return 0;
+    }
+    
+    *keylen = end-kanji;
+    return kanji;
+}
+
+char* rtk_layer_read(const char *path, struct rtklayer *stamp)
+{
+    FILE *file;
+    struct stat st;
+    char *buf;
+    
+    if(!(file = fopen(path, "r")))
+    {
+        error("Failed to open kanjifile");
+        return 0;
+    }
+    if(fstat(fileno(file), &st))
+    {
+        error("Failed to open kanjifile");
+        fclose(file);
+        return 0;
+    }
+    
+    buf = malloc(st.st_size+1);
+    buf[fread(buf, 1, st.st_size, file)] = 0;
+    fclose(file);
+    
+    stamp->mtime = st.st_mtime;
+    stamp->size = st.st_size;
+    
+    return buf;
+}
+
+void rtk_merge_free(struct rtkmerge *m)
+{
+    int x;
+    
+    for(x=0; x<rtk_layer_count; x++)
+        free(m->bufs[x]);
+    free(m->bufs);
+    free(m->lines);
+    free(m->lens);
+    free(m->nums);
+    free(m->hashes);
+    free(m->stamps);
+}
+
+int rtk_layer_merge(struct rtkmerge *m)
+{
+    char **keys, *line, *next;
+    int *keylens, *layers, *chain, *hash, x, y, z, lnum, mask, slot, count, cap;
+    unsigned int hval;
+    unsigned long long lhash;
+    
+    // every layer is read whole, lines point into the buffers
+    memset(m, 0, sizeof(struct rtkmerge));
+    m->bufs = calloc(rtk_layer_count, sizeof(char*));
+    m->stamps = calloc(rtk_layer_count, sizeof(struct rtklayer));
+    keys = 0;
+    keylens = 0;
+    layers = 0;
+    count = cap = 0;
+    
+    for(x=0; x<rtk_layer_count; x++)
+    {
+        if(!(m->bufs[x] = rtk_layer_read(rtk_layers[x].file, &m->stamps[x])))
+            break;
+        
+        for(line=m->bufs[x], lnum=1; *line; line=next, lnum++)
+        {
+            next = line+strcspn(line, "\n");
+            if(*next)
+                next++;
+            if(*line == '\n' || *line == '#')
+                continue;
+            
+            if(count == cap)
+            {
+                cap = cap ? 2*cap : DEFAULT_CAP*DEFAULT_CAP;
+                m->lines = realloc(m->lines, cap*sizeof(char*));
+                m->lens = realloc(m->lens, cap*sizeof(int));
+                m->nums = realloc(m->nums, cap*sizeof(int));
+                keys = realloc(keys, cap*sizeof(char*));
+                keylens = realloc(keylens, cap*sizeof(int));
+                layers = realloc(layers, cap*sizeof(int));
+            }
+            m->lines[count] = line;
+            m->lens[count] = strcspn(line, "\n");
+            m->nums[count] = lnum;
+            keys[count] = rtk_layer_key(line, m->lens[count], &keylens[count]);
+            layers[count] = x;
+            count++;
+        }
+    }
+    
+    // a layer failing to read keeps the index as it is
+    if(x < rtk_layer_count)
+    {
+        free(keys);
+        free(keylens);
+        free(layers);
+        rtk_merge_free(m);
+        return 1;
+    }
+    
+    // later layers replace entries of the same key in place,
+    // add new ones at the end and delete them with '!key', lines
+    // of one layer sharing a key are all kept and chained, the
+    // layer of an entry is kept in layers at its merged index
+    for(mask=1; mask < 2*count; mask <<= 1);
+    hash = malloc(mask*sizeof(int));
+    memset(hash, -1, mask*sizeof(int));
+    mask--;
+    chain = malloc((count ? count : 1)*sizeof(int));
+    
+    for(x=0, y=0; x<count; x++)
+    {
+        // unparsable lines are kept to be warned about on load
+        if(!keys[x])
+        {
+            m->lines[y] = m->lines[x];
+            m->lens[y] = m->lens[x];
+            m->nums[y] = m->nums[x];
+            keys[y++] = 0;
+            continue;
+        }
+        
+        for(hval=2166136261u, slot=0; slot<keylens[x]; slot++)
+            hval = (hval ^ (unsigned char)keys[x][slot]) * 16777619u;
+        
+        slot = hval & mask;
+        while(hash[slot] != -1 && (keylens[hash[slot]] != keylens[x]
+                || memcmp(keys[hash[slot]], keys[x], keylens[x])))
+            slot = (slot+1) & mask;
+        
+        if(*m->lines[x] == '!')
+        {
+            for(z=hash[slot]; z != -1; z=chain[z])
+                m->lens[z] = -1;
+            continue;
+        }
+        
+        // a key of the same layer adds another entry, one of an
+        // earlier or deleted entry replaces the first and drops the rest
+        if(hash[slot] == -1 || (layers[hash[slot]] == layers[x] && m->lens[hash[slot]] != -1))
+        {
+            for(z=hash[slot]; z != -1 && chain[z] != -1; z=chain[z]);
+            if(z == -1)
+                hash[slot] = y;
+            else
+                chain[z] = y;
+            z = y++;
+            chain[z] = -1;
+            keys[z] = keys[x];
+            keylens[z] = keylens[x];
+        }
+        else
+        {
+            z = hash[slot];
+            for(slot=chain[z]; slot != -1; slot=chain[slot])
+                m->lens[slot] = -1;
+            chain[z] = -1;
+        }
+        layers[z] = layers[x];
+        m->lines[z] = m->lines[x];
+        m->lens[z] = m->lens[x];
+        m->nums[z] = m->nums[x];
+    }
+    free(hash);
+    free(chain);
+    free(keys);
+    free(keylens);
+    free(layers);
+    
+    // drop deleted entries, reloads compare a hash of every line
+    // left and a digest of all of them
+    m->hashes = malloc((y ? y : 1)*sizeof(unsigned long long));
+    m->digest = 14695981039346656037ull;
+    for(x=0, count=y, y=0; x<count; x++)
+    {
+        if(m->lens[x] == -1)
+            continue;
+        m->lines[y] = m->lines[x];
+        m->lens[y] = m->lens[x];
+        m->nums[y] = m->nums[x];
+        for(slot=0, lhash=14695981039346656037ull; slot<m->lens[y]; slot++)
+            lhash = (lhash ^ (unsigned char)m->lines[y][slot]) * 1099511628211ull;
+        m->hashes[y] = lhash;
+        m->digest = (m->digest ^ lhash) * 1099511628211ull;
+        y++;
+    }
+    m->count = y;
+    
+    return 0;
+}
+
+void rtk_layer_stamp(struct rtkmerge *m)
+{
+    int x;
+    
+    // files are merged again once changed after this read
+    for(x=0; x<rtk_layer_count; x++)
+    {
+        rtk_layers[x].mtime = m->stamps[x].mtime;
+        rtk_layers[x].size = m->stamps[x].size;
+    }
+}
+
+void rtk_result_reset(struct rtkcontext *c)
+{
+    memset(c->results, 0, c->result_count*sizeof(struct rtkresult));
+    c->result_count = 0;
+    c->result_allot = 0;
+}
+
+void rtk_context_fit(struct rtkcontext *c)
+{
+    if(!c->results)
+    {
+        c->results = calloc(DEFAULT_CAP, sizeof(struct rtkresult));
+        c->result_cap = DEFAULT_CAP;
+    }
+    
+    // sized to the index when it was loaded last,
+    // match counts and stamps are left zero by every lookup
+    if(c->entries != rtk_entry_count+1)
+    {
+        c->entries = rtk_entry_count+1;
+        free(c->match_count);
+        free(c->match_stamp);
+        c->match_count = calloc(c->entries, sizeof(int));
+        c->match_stamp = calloc(c->entries, 1);
+        c->touched = realloc(c->touched, c->entries*sizeof(int));
+        c->set = realloc(c->set, c->entries*sizeof(int));
+        c->set_term = realloc(c->set_term, c->entries*sizeof(int));
+    }
+    
+    if(c->decode_cap < rtk_contain_max)
+    {
+        c->decode_cap = rtk_contain_max;
+        c->decode = realloc(c->decode, c->decode_cap*sizeof(int));
+        c->decode_times = realloc(c->decode_times, c->decode_cap);
+        c->decode_pred = realloc(c->decode_pred, c->decode_cap*sizeof(int));
+    }
+}
+
+void rtk_context_clear(struct rtkcontext *c)
+{
+    free(c->results);
+    free(c->terms);
+    free(c->term_of);
+    free(c->term_order);
+    free(c->set);
+    free(c->set_term);
+    free(c->match_count);
+    free(c->match_stamp);
+    free(c->touched);
+    free(c->pool);
+    free(c->pattern_words);
+    free(c->decode);
+    free(c->decode_times);
+    free(c->decode_pred);
+    free(c->scan);
+    memset(c, 0, sizeof(struct rtkcontext));
+}
+
+struct rtkcontext* rtk_context_new()
+{
+    return calloc(1, sizeof(struct rtkcontext));
+}
+
+void rtk_context_free(struct rtkcontext *c)
+{
+    if(!c)
+        return;
+    rtk_context_clear(c);
+    free(c);
+}
+
+void rtk_layer_free()
+{
+    free(rtk_layers);
+    rtk_layers = 0;
+    rtk_layer_count = 0;
+}
+
+void rtk_index_free()
+{
+    int x;
+    
+    free(rtk_strings);
+    free(rtk_numbers);
+    free(rtk_freq);
+    free(rtk_kanji);
+    free(rtk_meaning);
+    free(rtk_skip);
+    free(rtk_name_start);
+    free(rtk_names);
+    free(rtk_prim_start);
+    free(rtk_prims);
+    free(rtk_contain_start);
+    free(rtk_contain);
+    free(rtk_word_str);
+    rtk_strings = 0;
+    rtk_numbers = rtk_freq = rtk_kanji = rtk_meaning = rtk_word_str = rtk_contain_start = 0;
+    rtk_skip = rtk_contain = 0;
+    rtk_name_start = rtk_names = rtk_prim_start = rtk_prims = 0;
+    rtk_entry_count = rtk_word_count = rtk_string_len = rtk_string_cap = rtk_text_len = 0;
+    
+    free(rtk_joined);
+    rtk_joined = 0;
+    rtk_joined_count = 0;
+    free(rtk_bktree);
+    rtk_bktree = 0;
+    
+    free(rtk_post_start);
+    free(rtk_posts);
+    free(rtk_word_def);
+    free(rtk_kanji_hash);
+    free(rtk_word_hash);
+    free(rtk_frames);
+    free(rtk_named_start);
+    free(rtk_named);
+    free(rtk_sa);
+    rtk_post_start = rtk_posts = 0;
+    rtk_word_def = rtk_kanji_hash = 0;
+    rtk_word_hash = rtk_frames = rtk_named_start = rtk_named = 0;
+    rtk_sa = 0;
+    rtk_frame_count = rtk_sa_count = 0;
+    
+    for(x=0; x<rtk_unparsable_count; x++)
+        free(rtk_unparsable[x]);
+    free(rtk_unparsable);
+    free(rtk_unparsable_line);
+    free(rtk_orphans);
+    rtk_unparsable = 0;
+    rtk_unparsable_line = 0;
+    rtk_orphans = 0;
+    rtk_unparsable_count = rtk_unparsable_cap = 0;
+    
+    free(rtk_line_hash);
+    rtk_line_hash = 0;
+    rtk_line_count = 0;
+}
+
+int rtk_update_word(const char *str, int **list, int *count, int *cap)
+{
+    int len = strcspn(str, "\n"), id = -1, unknown;
+    char *word = malloc(len+1);
+    
+    if(*count == *cap)
+    {
+        *cap = *cap ? 2**cap : DEFAULT_CAP;
+        *list = realloc(*list, *cap*sizeof(int));
+    }
+    
+    // normalized like rtk_word_add, only words of the index
+    memcpy(word, str, len);
+    word[len] = 0;
+    rtk_norm(word, 0);
+    if(*word)
+        id = rtk_vocab_find(word);
+    unknown = *word && id == -1;
+    (*list)[(*count)++] = id;
+    free(word);
+    
+    return unknown;
+}
+
+void rtk_update_free(struct rtkupdate *u)
+{
+    int x;
+    
+    for(x=0; x<u->count; x++)
+    {
+        free(u->kanji[x]);
+        free(u->meaning[x]);
+    }
+    free(u->entry);
+    free(u->number);
+    free(u->skip);
+    free(u->kanji);
+    free(u->meaning);
+    free(u->name_start);
+    free(u->names);
+    free(u->prim_start);
+    free(u->prims);
+}
+
+int rtk_update_parse(struct rtkupdate *u, struct rtkmerge *m)
+{
+    char *line, *tmpstr, *num, *pskip, *kanji, *meaning, *alt, *kprim;
+    int x, k, skip, cap, linecap, skipped, fail;
+    
+    memset(u, 0, sizeof(struct rtkupdate));
+    
+    // entries keep their ids only if lines are edited in place
+    // or appended, unparsable ones are left to a full load to warn
+    if(m->count < rtk_line_count)
+        return 1;
+    
+    line = 0;
+    cap = linecap = skipped = fail = 0;
+    for(x=0; x<m->count && !fail; x++)
+    {
+        while(skipped < rtk_unparsable_count && rtk_unparsable_line[skipped] < x)
+            skipped++;
+        if(x < rtk_line_count && m->hashes[x] == rtk_line_hash[x])
+            continue;
+        if(skipped < rtk_unparsable_count && rtk_unparsable_line[skipped] == x)
+            fail = 1;
+        else if(rtk_parse(rtk_merge_line(m, x, &line, &linecap), &num, &pskip, &kanji, &meaning, &alt, &kprim))
+            fail = 1;
+        if(fail)
+            break;
+        
+        if(u->count == cap)
+        {
+            cap = cap ? 2*cap : DEFAULT_CAP;
+            u->entry = realloc(u->entry, cap*sizeof(int));
+            u->number = realloc(u->number, cap*sizeof(int));
+            u->skip = realloc(u->skip, cap);
+            u->kanji = realloc(u->kanji, cap*sizeof(char*));
+            u->meaning = realloc(u->meaning, cap*sizeof(char*));
+            u->name_start = realloc(u->name_start, (cap+1)*sizeof(int));
+            u->prim_start = realloc(u->prim_start, (cap+1)*sizeof(int));
+        }
+        
+        k = u->count++;
+        u->entry[k] = x-skipped;
+        u->number[k] = rtk_number(num);
+        u->kanji[k] = strdup(kanji);
+        u->meaning[k] = strdup(meaning);
+        u->name_start[k] = u->name_count;
+        u->prim_start[k] = u->prim_count;
+        skip = rtk_number(pskip);
+        
+        fail |= rtk_update_word(meaning, &u->names, &u->name_count, &u->name_cap);
+        tmpstr = strtok(alt, "/");
+        while(tmpstr && (tmpstr[0] != '-' || tmpstr[1]))
+        {
+            fail |= rtk_update_word(tmpstr, &u->names, &u->name_count, &u->name_cap);
+            tmpstr = strtok(0, "/");
+        }
+        u->skip[k] = skip < u->name_count-u->name_start[k] ? skip : u->name_count-u->name_start[k];
+        
+        if(kprim[0] == '-' && kprim[1] == '\n')
+            continue;
+        
+        tmpstr = strtok(kprim, "/");
+        while(tmpstr)
+        {
+            fail |= rtk_update_word(tmpstr, &u->prims, &u->prim_count, &u->prim_cap);
+            tmpstr = strtok(0, "/");
+        }
+    }
+    free(line);
+    
+    if(u->count)
+    {
+        u->name_start[u->count] = u->name_count;
+        u->prim_start[u->count] = u->prim_count;
+    }
+    
+    return fail || !u->count;
+}
+
+int rtk_update_vocab(struct rtkupdate *u)
+{
+    int *occ, x, y, k, e, fail;
+    
+    // the vocabulary stays if no word loses its last use,
+    // new words were refused when parsing already
+    occ = calloc(rtk_word_count ? rtk_word_count : 1, sizeof(int));
+    for(x=0; x<rtk_name_start[rtk_entry_count]; x++)
+        if(rtk_names[x] != -1)
+            occ[rtk_names[x]]++;
+    for(x=0; x<rtk_prim_start[rtk_entry_count]; x++)
+        if(rtk_prims[x] != -1)
+            occ[rtk_prims[x]]++;
+    
+    for(k=0; k<u->count; k++)
+    {
+        if((e = u->entry[k]) < rtk_entry_count)
+        {
+            for(y=rtk_name_start[e]; y<rtk_name_start[e+1]; y++)
+                if(rtk_names[y] != -1)
+                    occ[rtk_names[y]]--;
+            for(y=rtk_prim_start[e]; y<rtk_prim_start[e+1]; y++)
+                if(rtk_prims[y] != -1)
+                    occ[rtk_prims[y]]--;
+        }
+        for(y=u->name_start[k]; y<u->name_start[k+1]; y++)
+            if(u->names[y] != -1)
+                occ[u->names[y]]++;
+        for(y=u->prim_start[k]; y<u->prim_start[k+1]; y++)
+            if(u->prims[y] != -1)
+                occ[u->prims[y]]++;
+    }
+    
+    for(k=0, fail=0; k<u->count && !fail; k++)
+    {
+        if((e = u->entry[k]) >= rtk_entry_count)
+            continue;
+        for(y=rtk_name_start[e]; y<rtk_name_start[e+1]; y++)
+            if(rtk_names[y] != -1 && !occ[rtk_names[y]])
+                fail = 1;
+        for(y=rtk_prim_start[e]; y<rtk_prim_start[e+1]; y++)
+            if(rtk_prims[y] != -1 && !occ[rtk_prims[y]])
+                fail = 1;
+    }
+    free(occ);
+    
+    return fail;
+}
+
+unsigned int rtk_update_string(unsigned int old, int e, const char *str)
+{
+    // unchanged strings keep their place in the pool
+    if(e < rtk_entry_count && !strcmp(rtk_string(old), str))
+        return old;
+    return rtk_string_add(str, strlen(str));
+}
+
+void rtk_update_lists(int *upd, int count, int **start, int **list, const int *ustart, const int *ulist)
+{
+    int *nstart, *nlist, x, len, k;
+    
+    // entries changed take the parsed lists, the others their own
+    nstart = malloc((count+1)*sizeof(int));
+    for(x=0, len=0; x<count; x++)
+    {
+        nstart[x] = len;
+        if((k = upd[x]) != -1)
+            len += ustart[k+1]-ustart[k];
+        else
+            len += (*start)[x+1]-(*start)[x];
+    }
+    nstart[count] = len;
+    
+    nlist = malloc((len ? len : 1)*sizeof(int));
+    for(x=0; x<count; x++)
+    {
+        if((k = upd[x]) != -1)
+            memcpy(nlist+nstart[x], ulist+ustart[k], (ustart[k+1]-ustart[k])*sizeof(int));
+        else
+            memcpy(nlist+nstart[x], *list+(*start)[x], ((*start)[x+1]-(*start)[x])*sizeof(int));
+    }
+    
+    free(*start);
+    free(*list);
+    *start = nstart;
+    *list = nlist;
+}
+
+void rtk_update_apply(struct rtkupdate *u)
+{
+    struct rtkclosure cl;
+    int *upd, *wmark, *bstart, *bucket, *words, *post_start, *posts, *old_start;
+    unsigned int *contain_start;
+    unsigned char *contain, *aff, *times;
+    const unsigned char *buf;
+    int x, y, z, k, d, p, w, count, len, affected, total, old = rtk_entry_count, entries = old;
+    
+    for(k=0; k<u->count; k++)
+        if(u->entry[k] >= entries)
+            entries = u->entry[k]+1;
+    upd = malloc(entries*sizeof(int));
+    memset(upd, -1, entries*sizeof(int));
+    for(k=0; k<u->count; k++)
+        upd[u->entry[k]] = k;
+    
+    // words of the postings to rebuild, any name or contained
+    // word of a changed entry before and after
+    wmark = calloc(rtk_word_count ? rtk_word_count : 1, sizeof(int));
+    rtk_context_fit(&rtk_context);
+    
+    // words whose definitions changed, every entry with one of them
+    // as primitive gets its closure computed again
+    aff = calloc(entries, 1);
+    for(k=0; k<u->count; k++)
+    {
+        if((x = u->entry[k]) < old)
+            for(y=rtk_name_start[x]+rtk_skip[x]; y<rtk_name_start[x+1]; y++)
+                if(rtk_names[y] != -1)
+                    wmark[rtk_names[y]] |= 2;
+        for(y=u->name_start[k]+u->skip[k]; y<u->name_start[k+1]; y++)
+            if(u->names[y] != -1)
+                wmark[u->names[y]] |= 2;
+    }
+    
+    // entries get their new fields, strings fit the pool exactly
+    for(k=0, total=rtk_string_len; k<u->count; k++)
+        total += strlen(u->kanji[k])+strlen(u->meaning[k])+2;
+    if(total > rtk_string_cap)
+    {
+        rtk_string_cap = total;
+        rtk_strings = realloc(rtk_strings, rtk_string_cap);
+    }
+    rtk_entry_grow(entries);
+    for(k=0; k<u->count; k++)
+    {
+        x = u->entry[k];
+        rtk_numbers[x] = u->number[k];
+        rtk_skip[x] = u->skip[k];
+        rtk_kanji[x] = rtk_update_string(rtk_kanji[x], x, u->kanji[k]);
+        rtk_meaning[x] = rtk_update_string(rtk_meaning[x], x, u->meaning[k]);
+    }
+    rtk_strings = realloc(rtk_strings, rtk_string_len ? rtk_string_len : 1);
+    rtk_string_cap = rtk_string_len;
+    
+    // old names of changed entries leave their postings
+    for(k=0; k<u->count; k++)
+        if((x = u->entry[k]) < old)
+        {
+            for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+                if(rtk_names[y] != -1)
+                    wmark[rtk_names[y]] |= 1;
+        }
+    rtk_update_lists(upd, entries, &rtk_name_start, &rtk_names, u->name_start, u->names);
+    rtk_update_lists(upd, entries, &rtk_prim_start, &rtk_prims, u->prim_start, u->prims);
+    rtk_entry_count = entries;
+    
+    // affected in dictionary order, through definers being affected
+    rtk_closure_init(&cl, entries);
+    for(x=0, affected=0; x<entries; x++)
+    {
+        aff[x] = upd[x] != -1;
+        for(y=rtk_prim_start[x]; y<rtk_prim_start[x+1] && !aff[x]; y++)
+        {
+            if((p = rtk_prims[y]) == -1)
+                continue;
+            if(wmark[p] & 2)
+                aff[x] = 1;
+            for(d=cl.def_start[p]; d<cl.def_start[p+1] && cl.defs[d] < x && !aff[x]; d++)
+                aff[x] = aff[cl.defs[d]];
+        }
+        affected += aff[x];
+    }
+    
+    // closures of the others are decoded from the index as they were
+    cl.slot = malloc(entries*sizeof(int));
+    for(x=0, z=0; x<entries; x++)
+        cl.slot[x] = aff[x] ? z++ : -1;
+    for(x=0; x<old; x++)
+        if(aff[x])
+        {
+            count = rtk_contains(&rtk_context, x, &words, &times, 0);
+            for(y=0; y<count; y++)
+                wmark[words[y]] |= 1;
+        }
+    for(x=0; x<entries; x++)
+        if(aff[x])
+            rtk_closure_entry(&cl, x, cl.slot[x]);
+    
+    // encode the contained words of affected entries, the others
+    // are copied, predecessors are relative and stay valid
+    contain_start = malloc((entries+1)*sizeof(int));
+    for(x=0, len=0, rtk_contain_max=1; x<entries; x++)
+    {
+        contain_start[x] = len;
+        if(aff[x])
+        {
+            z = cl.slot[x];
+            count = cl.cstart[z+1]-cl.cstart[z];
+            len += rtk_contain_encode(0, cl.cwords+cl.cstart[z], cl.ctimes+cl.cstart[z], cl.cpred+cl.cstart[z], count);
+        }
+        else
+        {
+            buf = rtk_contain+rtk_contain_start[x];
+            count = rtk_varint_get(&buf) >> 1;
+            len += rtk_contain_start[x+1]-rtk_contain_start[x];
+        }
+        if(count > rtk_contain_max)
+            rtk_contain_max = count;
+    }
+    contain_start[entries] = len;
+    
+    contain = malloc(len ? len : 1);
+    for(x=0; x<entries; x++)
+    {
+        z = cl.slot[x];
+        if(aff[x])
+            rtk_contain_encode(contain+contain_start[x], cl.cwords+cl.cstart[z],
+                cl.ctimes+cl.cstart[z], cl.cpred+cl.cstart[z], cl.cstart[z+1]-cl.cstart[z]);
+        else
+            memcpy(contain+contain_start[x], rtk_contain+rtk_contain_start[x], contain_start[x+1]-contain_start[x]);
+    }
+    free(rtk_contain);
+    free(rtk_contain_start);
+    rtk_contain = contain;
+    rtk_contain_start = contain_start;
+    
+    // affected entries in order per marked word, merged with
+    // the postings of the others
+    bstart = calloc(rtk_word_count+1, sizeof(int));
+    bucket = 0;
+    for(x=0; x<entries; x++)
+    {
+        if(!aff[x])
+            continue;
+        z = cl.slot[x];
+        for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+            if(rtk_names[y] != -1)
+                wmark[rtk_names[y]] |= 1;
+        for(y=cl.cstart[z]; y<cl.cstart[z+1]; y++)
+            wmark[cl.cwords[y]] |= 1;
+    }
+    for(d=0; d<2; d++)
+    {
+        if(d)
+        {
+            for(w=0; w<rtk_word_count; w++)
+                bstart[w+1] += bstart[w];
+            bucket = malloc((bstart[rtk_word_count] ? bstart[rtk_word_count] : 1)*sizeof(int));
+            memcpy(cl.pos, bstart, rtk_word_count*sizeof(int));
+        }
+        memset(cl.stamp, 0, rtk_word_count*sizeof(int));
+        for(x=0; x<entries; x++)
+        {
+            if(!aff[x])
+                continue;
+            z = cl.slot[x];
+            count = 0;
+            for(y=rtk_name_start[x]; y<rtk_name_start[x+1]; y++)
+                rtk_closure_add(rtk_names[y], cl.stamp, x+1, cl.list, &count);
+            for(y=cl.cstart[z]; y<cl.cstart[z+1]; y++)
+                rtk_closure_add(cl.cwords[y], cl.stamp, x+1, cl.list, &count);
+            for(y=0; y<count; y++)
+                if(d)
+                    bucket[cl.pos[cl.list[y]]++] = x;
+                else
+                    bstart[cl.list[y]+1]++;
+        }
+    }
+    
+    old_start = rtk_post_start;
+    post_start = malloc((rtk_word_count+1)*sizeof(int));
+    for(w=0, len=0; w<rtk_word_count; w++)
+    {
+        post_start[w] = len;
+        if(!(wmark[w] & 1))
+            len += old_start[w+1]-old_start[w];
+        else
+        {
+            for(y=old_start[w]; y<old_start[w+1]; y++)
+                len += !aff[rtk_posts[y]];
+            len += bstart[w+1]-bstart[w];
+        }
+    }
+    post_start[rtk_word_count] = len;
+    
+    posts = malloc((len ? len : 1)*sizeof(int));
+    for(w=0; w<rtk_word_count; w++)
+    {
+        if(!(wmark[w] & 1))
+        {
+            memcpy(posts+post_start[w], rtk_posts+old_start[w], (old_start[w+1]-old_start[w])*sizeof(int));
+            continue;
+        }
+        for(y=old_start[w], z=bstart[w], len=post_start[w]; y<old_start[w+1] || z<bstart[w+1];)
+        {
+            if(y < old_start[w+1] && aff[rtk_posts[y]])
+                y++;
+            else if(z == bstart[w+1] || (y < old_start[w+1] && rtk_posts[y] < bucket[z]))
+                posts[len++] = rtk_posts[y++];
+            else
+                posts[len++] = bucket[z++];
+        }
+    }
+    free(rtk_posts);
+    free(old_start);
+    rtk_posts = posts;
+    rtk_post_start = post_start;
+    
+    rtk_closure_defs(&cl);
+    rtk_closure_free(&cl);
+    free(bstart);
+    free(bucket);
+    free(wmark);
+    free(aff);
+    free(upd);
+    
+    // cheap to build again, no parsing involved
+    free(rtk_kanji_hash);
+    free(rtk_frames);
+    free(rtk_named_start);
+    free(rtk_named);
+    rtk_kanji_index();
+    rtk_frame_index();
+}
+
+int rtk_index_update(struct rtkmerge *m)
+{
+    struct rtkupdate u;
+    double start;
+    
+    // only the changed lines are parsed, if they keep entry ids
+    // and vocabulary the closure and postings of entries and
+    // words they reach are rebuilt, else everything is
+    start = rtk_clock();
+    if(rtk_update_parse(&u, m) || rtk_update_vocab(&u))
+    {
+        rtk_update_free(&u);
+        return 1;
+    }
+    memset(rtk_phase_ms, 0, sizeof(rtk_phase_ms));
+    rtk_phase_ms[PHASE_PARSE] = rtk_clock()-start;
+    
+    start = rtk_clock();
+    rtk_update_apply(&u);
+    rtk_phase_ms[PHASE_CLOSURE] = rtk_clock()-start;
+    
+    free(rtk_line_hash);
+    rtk_line_hash = m->hashes;
+    rtk_line_count = m->count;
+    m->hashes = 0;
+    
+    rtk_update_free(&u);
+    return 0;
+}
+
+void rtk_lookup_free()
+{
+    if(!rtk_refs || --rtk_refs)
+        return;
+    
+    rtk_context_clear(&rtk_context);
+    rtk_index_free();
+    rtk_layer_free();
+}
+
+int rtk_lookup_init(int count, const char **files)
+{
+    struct rtkmerge m;
+    int x;
+    
+    // the dictionary is shared by all users
+    if(rtk_refs++)
+        return 0;
+    
+    // every file is a layer over the ones before
+    rtk_layers = calloc(count, sizeof(struct rtklayer));
+    rtk_layer_count = count;
+    for(x=0; x<count; x++)
+        rtk_layers[x].file = files[x];
+    
+    if(rtk_layer_merge(&m))
+    {
+        rtk_layer_free();
+        rtk_refs = 0;
+        return 1;
+    }
+    
+    rtk_layer_stamp(&m);
+    rtk_digest = m.digest;
+    rtk_dict_load(&m);
+    rtk_freq_load();
+    rtk_merge_free(&m);
+    
+    return 0;
+}
+
+int rtk_lookup_reload()
+{
+    struct rtkmerge m;
+    struct stat st;
+    int x;
+    
+    if(!rtk_refs)
+        return 0;
+    
+    // layers are only merged again if one of the files changed
+    for(x=0; x<rtk_layer_count; x++)
+        if(stat(rtk_layers[x].file, &st) || st.st_mtime != rtk_layers[x].mtime || st.st_size != rtk_layers[x].size)
+            break;
+    if(x == rtk_layer_count)
+        return 0;
+    
+    // and the index only rebuilt if the merged entries differ,
+    // failing files are read again on the next reload
+    if(rtk_layer_merge(&m))
+        return 0;
+    rtk_layer_stamp(&m);
+    if(m.digest == rtk_digest)
+    {
+        rtk_merge_free(&m);
+        return 0;
+    }
+    
+    print("reloading %i entries\n", m.count);
+    
+    // contexts of other threads are resized on their next lookup
+    rtk_result_reset(&rtk_context);
+    rtk_context.term_inputs = 0;
+    rtk_digest = m.digest;
+    if(rtk_index_update(&m))
+    {
+        rtk_index_free();
+        rtk_dict_load(&m);
+    }
+    rtk_freq_load();
+    rtk_merge_free(&m);
+    
+    return 1;
+}
+
+void rtk_memstat_add(struct rtkmemstat *stats, int max, int *count, const char *component, unsigned long bytes)
+{
+    if(*count < max)
+    {
+        stats[*count].component = component;
+        stats[*count].bytes = bytes;
+    }
+    (*count)++;
+}
+
+int rtk_lookup_memstats(struct rtkmemstat *stats, int max)
+{
+    struct rtkcontext *c = &rtk_context;
+    int count = 0, entries = rtk_entry_count+1, names, prims;
+    
+    if(!rtk_refs)
+        return 0;
+    
+    names = rtk_name_start[rtk_entry_count];
+    prims = rtk_prim_start[rtk_entry_count];
+    
+    // bytes allocated by every part of the index,
+    // scratch space of the default context counted as it is now
+    rtk_memstat_add(stats, max, &count, "strings", rtk_string_cap);
+    rtk_memstat_add(stats, max, &count, "entries", rtk_entry_count*(4*sizeof(int)+1));
+    rtk_memstat_add(stats, max, &count, "names", entries*sizeof(int)+names*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "primitives", entries*sizeof(int)+prims*sizeof(int)
+        +rtk_word_count*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "contains", entries*sizeof(int)+rtk_contain_start[rtk_entry_count]);
+    rtk_memstat_add(stats, max, &count, "postings", (rtk_word_count+1)*sizeof(int)
+        +rtk_post_start[rtk_word_count]*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "vocabulary", rtk_word_count*2*sizeof(int)
+        +rtk_word_size*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "segmentation", rtk_joined_count*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "bk-tree", rtk_bktree ? rtk_word_count*sizeof(struct rtkbktree) : 0);
+    rtk_memstat_add(stats, max, &count, "suffix array", rtk_sa_count*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "lines", rtk_line_count*sizeof(unsigned long long));
+    rtk_memstat_add(stats, max, &count, "kanji", rtk_kanji_size*sizeof(int)+rtk_frame_count*sizeof(int)
+        +(rtk_word_count+1)*sizeof(int)+rtk_named_start[rtk_word_count]*sizeof(int));
+    rtk_memstat_add(stats, max, &count, "scratch", c->entries*(4*sizeof(int)+1)+c->decode_cap*(2*sizeof(int)+1)
+        +(c->pool_cap+c->pattern_cap)*sizeof(int)+c->term_cap*(sizeof(struct rtkterm)+2*sizeof(int))
+        +c->result_cap*sizeof(struct rtkresult));
+    
+    return count;
+}
+
+int rtk_lookup_stats(struct rtkstats *stats)
+{
+    struct rtkcontext *c = &rtk_context;
+    int *depth, *words, x, y, e, p, d, count;
+    unsigned char *times;
+    char *used;
+    
+    if(!rtk_refs)
+        return 1;
+    
+    rtk_context_fit(c);
+    memset(stats, 0, sizeof(struct rtkstats));
+    stats->entries = rtk_entry_count;
+    stats->words = rtk_word_count;
+    
+    depth = malloc((rtk_entry_count ? rtk_entry_count : 1)*sizeof(int));
+    used = calloc(rtk_word_count ? rtk_word_count : 1, 1);
+    
+    for(e=0; e<rtk_entry_count; e++)
+    {
+        if(rtk_numbers[e])
+            stats->numbered++;
+        
+        // fan-out counts the primitives of an entry, depth the
+        // levels of entries defining them like rtk_decompose does
+        for(x=rtk_prim_start[e], count=0, depth[e]=0; x<rtk_prim_start[e+1]; x++)
+        {
+            if((p = rtk_prims[x]) == -1)
+                continue;
+            count++;
+            used[p] = 1;
+            d = rtk_word_def[p];
+            if(d != -1 && d < e && depth[d]+1 > depth[e])
+                depth[e] = depth[d]+1;
+        }
+        stats->fanout[count < RTK_STATS_HIST ? count : RTK_STATS_HIST-1]++;
+        stats->depth[depth[e] < RTK_STATS_HIST ? depth[e] : RTK_STATS_HIST-1]++;
+        
+        // largest transitive closures, earlier entries first on ties
+        count = rtk_contains(c, e, &words, &times, 0);
+        for(x=stats->closures; x>0 && stats->closure_size[x-1] < count; x--)
+            if(x < RTK_STATS_TOP)
+            {
+                stats->closure_kanji[x] = stats->closure_kanji[x-1];
+                stats->closure_meaning[x] = stats->closure_meaning[x-1];
+                stats->closure_size[x] = stats->closure_size[x-1];
+            }
+        if(x < RTK_STATS_TOP)
+        {
+            stats->closure_kanji[x] = rtk_string(rtk_kanji[e]);
+            stats->closure_meaning[x] = rtk_string(rtk_meaning[e]);
+            stats->closure_size[x] = count;
+            if(stats->closures < RTK_STATS_TOP)
+                stats->closures++;
+        }
+    }
+    
+    // primitives nothing is named by
+    rtk_orphans = realloc(rtk_orphans, (rtk_word_count ? rtk_word_count : 1)*sizeof(int));
+    for(x=0, y=0; x<rtk_word_count; x++)
+    {
+        stats->primitives += used[x];
+        if(used[x] && rtk_word_def[x] == -1)
+            rtk_orphans[y++] = x;
+    }
+    stats->orphans = rtk_orphans;
+    stats->orphan_count = y;
+    
+    stats->unparsable = (const char**)rtk_unparsable;
+    stats->unparsable_count = rtk_unparsable_count;
+    
+    for(x=0; x<RTK_STATS_PHASES; x++)
+    {
+        stats->phase[x] = rtk_phase_name[x];
+        stats->phase_ms[x] = rtk_phase_ms[x];
+    }
+    
+    free(depth);
+    free(used);
+    
+    return 0;
+}
+
+void rtk_scan_add(struct rtkcontext *c, int *pool, int id, char *num, char *kanji, char *meaning, int allot)
+{
+    int pos = rtk_result_slot(c, allot), len;
+    
+    // strings of a file read as it is are kept with the context,
+    // sized to the file they never outgrow it
+    c->results[pos].number = rtk_number(num);
+    c->results[pos].kanji = c->scan+*pool;
+    len = strlen(kanji)+1;
+    memcpy(c->scan+*pool, kanji, len);
+    *pool += len;
+    c->results[pos].meaning = c->scan+*pool;
+    len = strlen(meaning)+1;
+    memcpy(c->scan+*pool, meaning, len);
+    *pool += len;
+    c->results[pos].id = id;
+}
+
+struct rtkresult* rtk_lookup_scan(int argc, struct rtkinput *argv)
+{
+    struct rtkcontext *c = &rtk_context;
+    struct rtkprim *prim, ptmp1, ptmp2;
+    struct rtkmerge m;
+    struct rtklayer stamp;
+    int x, y, z, l, len, pool, found, foundpos, skip, allot, id, linecap;
+    char *raw, *next, *line, *tmpstr;
+    char *num, *pskip, *kanji, *meaning, *alt, *kprim;
+    
+    if(!argc)
+        return 0;
+    
+    // a single file is read line by line as it is, apart from
+    // the merge the index loads through, layers are merged again
+    // like on a reload
+    raw = 0;
+    if(rtk_layer_count == 1)
+    {
+        if(!(raw = rtk_layer_read(rtk_layers[0].file, &stamp)))
+            return 0;
+    }
+    else if(rtk_layer_merge(&m))
+        return 0;
+    
+    prim = malloc((argc)*sizeof(struct rtkprim));
+    
+    rtk_context_fit(c);
+    if(c->result_count)
+        rtk_result_reset(c);
+    if(raw)
+        c->scan = realloc(c->scan, stamp.size+1);
+    
+    for(x=0; x<argc; x++)
+    {
+        prim[x].count = 0;
+        prim[x].cap = DEFAULT_CAP;
+        prim[x].prim = malloc(DEFAULT_CAP*sizeof(char**));
+        rtk_prim_add(argv[x].primitive, &prim[x], 1, 1);
+        argv[x].found = 0;
+    }
+    
+    line = 0;
+    linecap = 0;
+    id = -1;
+    pool = 0;
+    for(l=0, next=raw; raw ? *next != 0 : l<m.count; l++)
+    {
+        if(raw)
+        {
+            len = strcspn(next, "\n");
+            if(len+2 > linecap)
+            {
+                linecap = 2*(len+2);
+                line = realloc(line, linecap);
+            }
+            memcpy(line, next, len);
+            line[len] = '\n';
+            line[len+1] = 0;
+            next += len+(next[len] != 0);
+            
+            if(*line == '\n' || *line == '#')
+                continue;
+        }
+        else
+            rtk_merge_line(&m, l, &line, &linecap);
+        
+        if(rtk_parse(line, &num, &pskip, &kanji, &meaning, &alt, &kprim))
+        {
+            warn("failed to parse line %i\n", raw ? l+1 : m.nums[l]);
+            continue;
+        }
+        
+        // lines are counted like the entries in rtk_dict_load
+        id++;
+        
+        ptmp1.count = 0;
+        ptmp1.cap = DEFAULT_CAP;
+        ptmp1.prim = malloc(DEFAULT_CAP*sizeof(char**));
+        
+        // create list of meaning and alternative meanings
+        rtk_prim_add(meaning, &ptmp1, 1, 0);
+        tmpstr = strtok(alt, "/");
+        while(tmpstr && (tmpstr[0] != '-' || tmpstr[1]))
+        {
+            rtk_prim_add(tmpstr, &ptmp1, 1, 0);
+            tmpstr = strtok(0, "/");
+        }
+        
+        // ignore meaning/alternatives
+        skip = rtk_number(pskip);
+        
+        // for every user entered primitive
+        // if the primitive is found in the meaning or alt meanings
+        // add those except the one found to the respective
+        // primitive list
+        found = allot = 0;
+        foundpos = -1;
+        for(x=0; x<argc; x++)
+        {
+            prim[x].flag &= ~FLAG_FOUND;
+            
+            for(z=0; z<ptmp1.count; z++)
+                if((!PREFIX(prim[x]) && !strcmp(prim[x].prim[0], ptmp1.prim[z]))
+                    || (PREFIX(prim[x]) && !strncmp(prim[x].prim[0], ptmp1.prim[z], strlen(prim[x].prim[0]))))
+                {
+                    found++;
+                    allot = 1;
+                    argv[x].found = 1;
+                    prim[x].flag |= FLAG_FOUND;
+                    
+                    // only add if found meaning/alt not skipped
+                    // and add only those which are not skipped
+                    if(found == 1 && z >= skip)
+                    {
+                        foundpos = z;
+                        for(z=skip; z<ptmp1.count; z++)
+                            if(z != foundpos)
+                                rtk_prim_add(ptmp1.prim[z], &prim[x], 0, 0);
+                    }
+                    break;
+                }
+        }
+        
+        // continue if no sub primitives
+        if(kprim[0] == '-' && kprim[1] == '\n')
+        {
+            if(found == argc && rtk_number(num) && raw)
+                rtk_scan_add(c, &pool, id, num, kanji, meaning, allot);
+            else if(found == argc && rtk_number(num))
+                rtk_result_add(c, id, allot);
+            
+            rtk_prim_free(&ptmp1);
+            continue;
+        }
+        
+        // create list of sub primitives
+        ptmp2.count = 0;
+        ptmp2.cap = DEFAULT_CAP;
+        ptmp2.prim = malloc(DEFAULT_CAP*sizeof(char**));
+        tmpstr = strtok(kprim, "/");
+        while(tmpstr)
+        {
+            rtk_prim_add(tmpstr, &ptmp2, 1, 0);
+            tmpstr = strtok(0, "/");
+        }
+        
+        // for every user entered primitive
+        // if one of the respective primitive list matches one out
+        // of the current list of sub primitives
+        // add meaning and alt meaning of the current kanji to the
+        // respective primitive list
+        found = 0;
+        for(x=0; x<argc; x++)
+        {
+            z = 0;
+            for(y=0; y<prim[x].count; y++)
+                for(z=0; z<ptmp2.count; z++)
+                    if((!PREFIX(prim[x]) && !strcmp(prim[x].prim[y], ptmp2.prim[z]))
+                        || (PREFIX(prim[x]) && !strncmp(prim[x].prim[y], ptmp2.prim[z], strlen(prim[x].prim[y]))))
+                    {
+                        found++;
+                        y = prim[x].count;
+                        z = -1;
+                        break;
+                    }
+            if(z == -1)
+            {
+                // skip meaning/alt if already defined as primitive/alt
+                for(z=skip; z<ptmp1.count; z++)
+                    rtk_prim_add(ptmp1.prim[z], &prim[x], 0, 0);
+            }
+            // mark found if meaning == user entered primitive
+            else if(prim[x].flag & FLAG_FOUND)
+                found++;
+        }
+        
+        // if for every primitve list a matching one is found
+        // and the current kanji is not numberless
+        if(found >= argc && rtk_number(num) && raw)
+            rtk_scan_add(c, &pool, id, num, kanji, meaning, allot);
+        else if(found >= argc && rtk_number(num))
+            rtk_result_add(c, id, allot);
+        
+        rtk_prim_free(&ptmp1);
+        rtk_prim_free(&ptmp2);
+    }
+    
+    for(x=0; x<argc; x++)
+        rtk_prim_free(&prim[x]);
+    
+    free(prim);
+    free(line);
+    if(raw)
+        free(raw);
+    else
+        rtk_merge_free(&m);
+    
+    if(!c->result_count)
+        return 0;
+    return c->results;
+}
+
+int rtk_vocab_query(int id, char *buf, int size)
+{
+    char *word = rtk_word(id);
+    int len = strlen(word);
+    
+    if(len+2 > size)
+        return -1;
+    
+    // words ending with 's' get another one
+    // as the plural 's' is removed again on lookup
+    memcpy(buf, word, len);
+    if(word[len-1] == 's')
+        buf[len++] = 's';
+    buf[len] = 0;
+    
+    return len;
+}
+
+int rtk_segment_cmp(int x, int joined, const char *str, int len)
+{
+    if(joined)
+        return rtk_letters_cmp(rtk_word(rtk_joined[x]), str, len);
+    return strncmp(rtk_word(x), str, len);
+}
+
+void rtk_segment_range(int *lo, int *hi, int joined, const char *str, int len)
+{
+    int first, last, mid;
+    
+    // the words starting with len characters of str lie within
+    // the range of those starting with one character less
+    for(first=*lo, last=*hi; first<last;)
+    {
+        mid = (first+last)/2;
+        if(rtk_segment_cmp(mid, joined, str, len) < 0)
+            first = mid+1;
+        else
+            last = mid;
+    }
+    for(*lo=first, last=*hi; first<last;)
+    {
+        mid = (first+last)/2;
+        if(rtk_segment_cmp(mid, joined, str, len) <= 0)
+            first = mid+1;
+        else
+            last = mid;
+    }
+    *hi = first;
+}
+
+int rtk_segment_words(struct rtksegstate *state, int pos, int *end, int *word)
+{
+    const char *str = state->str+pos;
+    int lo, hi, jlo, jhi, len, id, count;
+    
+    // every word of the vocabulary starting at pos
+    // optionally followed by a plural 's', a word equal
+    // to the prefix sorts first among those starting with it
+    lo = jlo = count = 0;
+    hi = rtk_word_count;
+    jhi = rtk_joined_count;
+    for(len=1; pos+len <= state->len && (lo < hi || jlo < jhi); len++)
+    {
+        rtk_segment_range(&lo, &hi, 0, str, len);
+        rtk_segment_range(&jlo, &jhi, 1, str, len);
+        
+        // first of several words with same letters wins
+        id = lo < hi && !rtk_word(lo)[len] ? lo : -1;
+        if(jlo < jhi && rtk_letters_len(rtk_word(rtk_joined[jlo])) == len
+                && (id == -1 || rtk_joined[jlo] < id))
+            id = rtk_joined[jlo];
+        if(id == -1)
+            continue;
+        
+        end[count] = pos+len;
+        word[count++] = id;
+        
+        if(str[len] == 's')
+        {
+            end[count] = pos+len+1;
+            word[count++] = id;
+        }
+    }
+    
+    return count;
+}
+
+void rtk_segment_found(struct rtksegstate *state, int count)
+{
+    struct rtksegmentation *seg = &state->seg[state->found];
+    char *buf = seg->buf;
+    int x, len;
+    
+    seg->count = count;
+    for(x=0; x<count; x++)
+    {
+        seg->segment[x] = state->cur[x];
+        seg->segment[x].primitive = buf - seg->buf;
+        
+        len = rtk_vocab_query(state->cur[x].primitive, buf, seg->buf+sizeof(seg->buf)-buf);
+        if(len == -1)
+            return;
+        buf += len+1;
+    }
+    
+    state->found++;
+}
+
+void rtk_segment_next(struct rtksegstate *state, int pos, int depth)
+{
+    int end[2*RTK_SEGMENT_LEN], word[2*RTK_SEGMENT_LEN];
+    int x, count;
+    
+    if(pos == state->len)
+    {
+        rtk_segment_found(state, depth);
+        return;
+    }
+    
+    if(depth == RTK_SEGMENT_MAX)
+        return;
+    
+    // longest words first, only continue where the rest can be segmented
+    count = rtk_segment_words(state, pos, end, word);
+    for(x=count-1; x>=0 && state->found < state->max; x--)
+        if(state->reach[end[x]])
+        {
+            state->cur[depth].start = pos;
+            state->cur[depth].len = end[x]-pos;
+            state->cur[depth].primitive = word[x];
+            rtk_segment_next(state, end[x], depth+1);
+        }
+}
+
+int rtk_segment(const char *str, struct rtksegmentation *seg, int max)
+{
+    struct rtksegstate state;
+    int end[2*RTK_SEGMENT_LEN], word[2*RTK_SEGMENT_LEN];
+    int x, y, count;
+    
+    if(!rtk_refs)
+        return 0;
+    
+    for(state.len=0; str[state.len]; state.len++)
+    {
+        if(state.len == RTK_SEGMENT_LEN)
+            return 0;
+        
+        state.str[state.len] = str[state.len];
+        if(state.str[state.len] >= 'A' && state.str[state.len] <= 'Z')
+            state.str[state.len] += 32;
+        else if(state.str[state.len] < 'a' || state.str[state.len] > 'z')
+            return 0;
+    }
+    
+    if(!state.len)
+        return 0;
+    
+    state.str[state.len] = 0;
+    
+    // mark every position from which the rest can be segmented
+    state.reach[state.len] = 1;
+    for(x=state.len-1; x>=0; x--)
+    {
+        state.reach[x] = 0;
+        count = rtk_segment_words(&state, x, end, word);
+        for(y=0; y<count && !state.reach[x]; y++)
+            state.reach[x] = state.reach[end[y]];
+    }
+    
+    if(!state.reach[0])
+        return 0;
+    
+    state.max = max;
+    state.found = 0;
+    state.seg = seg;
+    rtk_segment_next(&state, 0, 0);
+    
+    return state.found;
+}
+
+int rtk_vocab_copy(const char *str, char *buf)
+{
+    int len = strlen(str), exact;
+    
+    if(len > RTK_WORD_LEN)
+        return -1;
+    
+    memcpy(buf, str, len+1);
+    
+    // strip exclusion operator
+    if(buf[0] == '-' && buf[1])
+        memmove(buf, buf+1, len--);
+    
+    // strip exact operator, the word is never a prefix then
+    if((exact = buf[0] == '=' && buf[1]))
+        memmove(buf, buf+1, len--);
+    
+    // strip prefix flag
+    if(!exact && len && (buf[len-1] == '*' || buf[len-1] == '+'))
+    {
+        buf[--len] = 0;
+        return 1;
+    }
+    
+    return 0;
+}
+
+int rtk_vocab_norm(const char *str, char *buf)
+{
+    char *s = buf;
+    int prefix;
+    
+    // the form a term is looked up in, operators and the prefix flag
+    // are kept as they change what it matches
+    if(str[0] == '-' && str[1])
+        *s++ = '-';
+    if(str[s-buf] == '=' && str[s-buf+1])
+        *s++ = '=';
+    if((prefix = rtk_vocab_copy(str, s)) == -1)
+        return -1;
+    
+    // kanji and frame numbers are not words
+    if(!((unsigned char)*s & 0x80 || *s == '#'))
+        rtk_norm(*s == '*' ? s+1 : s, prefix);
+    if(prefix)
+        strcat(s, "*");
+    
+    return strlen(buf);
+}
+
+int rtk_vocab_complete(const char *str, int *first)
+{
+    char buf[RTK_WORD_LEN+1];
+    size_t len;
+    
+    if(rtk_vocab_copy(str, buf) == -1)
+        return 0;
+    
+    rtk_norm(buf, 1);
+    if(!(len = strlen(buf)))
+        return 0;
+    
+    *first = rtk_vocab_search(buf, len, 0);
+    return rtk_vocab_search(buf, len, 1) - *first;
+}
+
+int rtk_frame_find(const char *str)
+{
+    int number;
+    
+    if(str[0] != '#' || !(number = rtk_number((char*)str+1)) || number >= rtk_frame_count)
+        return -1;
+    return rtk_frames[number];
+}
+
+int rtk_vocab_match(const char *str, int *first)
+{
+    char buf[RTK_WORD_LEN+1];
+    int prefix;
+    
+    // range of words a user entered primitive matches
+    // prefix primitives match every word they complete
+    if((prefix = rtk_vocab_copy(str, buf)) == -1)
+        return 0;
+    
+    // a kanji or frame number stands for its keyword
+    if((unsigned char)buf[0] & 0x80 || buf[0] == '#')
+    {
+        if((*first = buf[0] == '#' ? rtk_frame_find(buf) : rtk_kanji_find(buf)) == -1
+            || rtk_name_start[*first] == rtk_name_start[*first+1])
+            return 0;
+        return (*first = rtk_names[rtk_name_start[*first]]) != -1;
+    }
+    
+    if(prefix)
+        return rtk_vocab_complete(str, first);
+    
+    rtk_norm(buf, 0);
+    return (*first = rtk_vocab_find(buf)) != -1;
+}
+
+int rtk_pattern(struct rtkcontext *c, const char *str, const int **words)
+{
+    char buf[RTK_WORD_LEN+2];
+    int x, y, first, count, len, substring;
+    
+    // '*word' matches words ending with word, '*word*' words containing it
+    if(!rtk_sa_count || (substring = rtk_vocab_copy(str, buf)) == -1 || buf[0] != '*')
+        return -1;
+    
+    rtk_norm(buf+1, substring);
+    if(!(len = strlen(buf+1)))
+        return -1;
+    // words end with 0 in the pool
+    if(!substring)
+        len++;
+    
+    // a pattern matching nothing needs no words, they may not exist yet
+    *words = c->pattern_words;
+    if(!(count = rtk_suffix_range(buf+1, len, &first)))
+        return 0;
+    if(count >= c->pattern_cap)
+    {
+        c->pattern_cap = 2*count+1;
+        c->pattern_words = realloc(c->pattern_words, c->pattern_cap*sizeof(int));
+    }
+    for(x=0; x<count; x++)
+        c->pattern_words[x] = rtk_suffix_word(rtk_sa[first+x]);
+    
+    // a word may contain the pattern more than once
+    qsort(c->pattern_words, count, sizeof(int), rtk_int_cmp);
+    for(x=0, y=0; x<count; x++)
+        if(!y || c->pattern_words[y-1] != c->pattern_words[x])
+            c->pattern_words[y++] = c->pattern_words[x];
+    
+    *words = c->pattern_words;
+    return y;
+}
+
+int rtk_vocab_pattern(const char *str, const int **words)
+{
+    return rtk_pattern(&rtk_context, str, words);
+}
+
+int rtk_vocab_known(const char *str)
+{
+    const int *words;
+    int first, count;
+    
+    if((count = rtk_vocab_pattern(str, &words)) != -1)
+        return count > 0;
+    return rtk_vocab_match(str, &first) > 0;
+}
+
+const char* rtk_vocab_word(int id)
+{
+    return rtk_word(id);
+}
+
+void rtk_bktree_find(int node, const char *str, int *best, int *dist)
+{
+    int x, d;
+    
+    d = rtk_distance(str, rtk_word(node));
+    if(d < *dist || (d == *dist && node < *best))
+    {
+        *best = node;
+        *dist = d;
+    }
+    
+    // only subtrees within the best distance so far can do better
+    for(x=rtk_bktree[node].child; x != -1; x=rtk_bktree[x].next)
+        if(rtk_bktree[x].dist >= d-*dist && rtk_bktree[x].dist <= d+*dist)
+            rtk_bktree_find(x, str, best, dist);
+}
+
+int rtk_vocab_fuzzy(const char *str, char *buf, int size)
+{
+    char norm[RTK_WORD_LEN+1];
+    int best, dist;
+    
+    if(!rtk_word_count || rtk_vocab_copy(str, norm) || ((unsigned char)norm[0] & 0x80) || norm[0] == '*')
+        return -1;
+    
+    rtk_norm(norm, 0);
+    if(!*norm)
+        return -1;
+    
+    // short words may differ in one character, longer ones in two
+    best = -1;
+    dist = (strlen(norm) > 4 ? 2 : 1) + 1;
+    rtk_bktree_find(0, norm, &best, &dist);
+    
+    if(best == -1 || rtk_vocab_query(best, buf, size) == -1)
+        return -1;
+    
+    return dist;
+}
+
+int rtk_query(struct rtkcontext *c, int argc, struct rtkinput *argv)
+{
+    struct rtkterm *t;
+    const int *words;
+    int x, y, first, count, exclude, terms, pattern;
+    
+    if(argc > c->term_cap)
+    {
+        c->term_cap = argc;
+        c->terms = realloc(c->terms, c->term_cap*sizeof(struct rtkterm));
+        c->term_of = realloc(c->term_of, c->term_cap*sizeof(int));
+        c->term_order = realloc(c->term_order, c->term_cap*sizeof(int));
+    }
+    
+    // query := term*
+    // term  := ['-'] ['*'] word ['*'|'+']
+    // '-' excludes kanji containing the word, a trailing '*' or '+'
+    // matches every word starting with it, a leading '*' every word
+    // ending with it and both every word containing it,
+    // a repeated term must be contained that often
+    // words of patterns are kept in the pool, others are a range
+    c->pool_len = 0;
+    c->term_inputs = argc;
+    for(x=0, terms=0; x<argc; x++)
+    {
+        exclude = argv[x].primitive[0] == '-' && argv[x].primitive[1];
+        
+        if((count = rtk_pattern(c, argv[x].primitive, &words)) != -1)
+        {
+            // the pool is only touched by patterns matching words
+            if(c->pool_len+count > c->pool_cap)
+            {
+                c->pool_cap = 2*(c->pool_len+count);
+                c->pool = realloc(c->pool, c->pool_cap*sizeof(int));
+            }
+            if(count)
+                memcpy(c->pool+c->pool_len, words, count*sizeof(int));
+            pattern = 1;
+            first = -1;
+        }
+        else
+        {
+            count = rtk_vocab_match(argv[x].primitive, &first);
+            pattern = 0;
+        }
+        
+        for(y=0; y<terms; y++)
+            if(c->terms[y].exclude == exclude && c->terms[y].count == count
+                && (pattern ? c->terms[y].words != -1 && (!count || !memcmp(c->pool+c->terms[y].words,
+                        c->pool+c->pool_len, count*sizeof(int)))
+                    : c->terms[y].words == -1 && c->terms[y].first == first))
+                break;
+        
+        c->term_of[x] = y;
+        t = &c->terms[y];
+        if(y < terms)
+        {
+            t->times++;
+            continue;
+        }
+        
+        t->first = count && !pattern ? first : -1;
+        t->words = pattern ? c->pool_len : -1;
+        if(pattern)
+            c->pool_len += count;
+        t->count = count;
+        t->times = 1;
+        t->found = 0;
+        t->exclude = exclude;
+        t->input = x;
+        terms++;
+        
+        // the candidate sets of the words bound the size of the term,
+        // ranges take it from the prefix sums of the posting lists
+        if(!pattern)
+            t->size = count ? rtk_post_start[first+count]-rtk_post_start[first] : 0;
+        else
+            for(y=0, t->size=0; y<count; y++)
+                t->size += rtk_post_start[words[y]+1]-rtk_post_start[words[y]];
+    }
+    
+    return terms;
+}
+
+int rtk_term_word(struct rtkcontext *c, struct rtkterm *t, int x)
+{
+    return t->words == -1 ? t->first+x : c->pool[t->words+x];
+}
+
+int rtk_term_has(struct rtkcontext *c, struct rtkterm *t, int word)
+{
+    if(t->words == -1)
+        return word >= t->first && word < t->first+t->count;
+    return bsearch(&word, c->pool+t->words, t->count, sizeof(int), rtk_int_cmp) != 0;
+}
+
+int rtk_term_times(struct rtkcontext *c, int e, struct rtkterm *t)
+{
+    int *words, x, lo, hi, mid, count, times = 0;
+    unsigned char *mult;
+    
+    // names count once, contained words as often as contained
+    for(x=rtk_name_start[e]; x<rtk_name_start[e+1]; x++)
+        if(rtk_term_has(c, t, rtk_names[x]))
+        {
+            times = 1;
+            break;
+        }
+    
+    count = rtk_contains(c, e, &words, &mult, 0);
+    
+    if(t->words != -1)
+    {
+        for(x=0; x<count; x++)
+            if(mult[x] > times && rtk_term_has(c, t, words[x]))
+                times = mult[x];
+        return times;
+    }
+    
+    for(lo=0, hi=count; lo<hi;)
+    {
+        mid = (lo+hi)/2;
+        if(words[mid] < t->first)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    for(; lo<count && words[lo] < t->first+t->count; lo++)
+        if(mult[lo] > times)
+            times = mult[lo];
+    
+    return times;
+}
+
+int rtk_term_set(struct rtkcontext *c, struct rtkterm *t, int times, int **set)
+{
+    int w, x, y, e, count;
+    
+    // a single word without multiplicity is its candidate set
+    if(t->count == 1 && times == 1)
+    {
+        w = rtk_term_word(c, t, 0);
+        *set = rtk_posts+rtk_post_start[w];
+        return rtk_post_start[w+1]-rtk_post_start[w];
+    }
+    
+    // union of the candidate sets of all words the term matches
+    *set = c->set_term;
+    for(x=0, count=0; x<t->count; x++)
+        for(w=rtk_term_word(c, t, x), y=rtk_post_start[w]; y<rtk_post_start[w+1]; y++)
+        {
+            e = rtk_posts[y];
+            if(c->match_stamp[e])
+                continue;
+            c->match_stamp[e] = 1;
+            if(times == 1 || rtk_term_times(c, e, t) >= times)
+                c->set_term[count++] = e;
+        }
+    
+    for(x=0; x<t->count; x++)
+        for(w=rtk_term_word(c, t, x), y=rtk_post_start[w]; y<rtk_post_start[w+1]; y++)
+            c->match_stamp[rtk_posts[y]] = 0;
+    
+    if(t->count > 1)
+        qsort(c->set_term, count, sizeof(int), rtk_int_cmp);
+    
+    return count;
+}
+
+int rtk_set_and(int *a, int na, const int *b, int nb)
+{
+    int x, y, n;
+    
+    // in place, the result is never longer than a
+    for(x=0, y=0, n=0; x<na && y<nb;)
+        if(a[x] < b[y])
+            x++;
+        else if(a[x] > b[y])
+            y++;
+        else
+        {
+            a[n++] = a[x++];
+            y++;
+        }
+    
+    return n;
+}
+
+int rtk_set_minus(int *a, int na, const int *b, int nb)
+{
+    int x, y, n;
+    
+    for(x=0, y=0, n=0; x<na;)
+        if(y == nb || a[x] < b[y])
+            a[n++] = a[x++];
+        else if(a[x] > b[y])
+            y++;
+        else
+            x++;
+    
+    return n;
+}
+
+int rtk_set_probe(struct rtkcontext *c, int *a, int na, struct rtkterm *t, int keep)
+{
+    int x, n;
+    
+    // few candidates left are checked against the term
+    // instead of collecting its candidate set
+    for(x=0, n=0; x<na; x++)
+        if((rtk_term_times(c, a[x], t) >= t->times) == keep)
+            a[n++] = a[x];
+    
+    return n;
+}
+
+int rtk_set_named(struct rtkcontext *c, int e, int terms)
+{
+    int x, y;
+    
+    // kanji whose meaning is one of the primitives
+    for(x=0; x<terms; x++)
+        if(!c->terms[x].exclude)
+            for(y=rtk_name_start[e]; y<rtk_name_start[e+1]; y++)
+                if(rtk_term_has(c, &c->terms[x], rtk_names[y]))
+                    return 1;
+    
+    return 0;
+}
+
+int rtk_lookup_direct(struct rtkcontext *c, struct rtkinput *input)
+{
+    char buf[RTK_WORD_LEN+1];
+    int x, e, word;
+    
+    input->found = 0;
+    
+    // '#number' is the entry of the frame
+    if(input->primitive[0] == '#')
+    {
+        if((e = rtk_frame_find(input->primitive)) == -1)
+            return 0;
+        rtk_result_add(c, e, 1);
+        input->found = 1;
+        return 1;
+    }
+    
+    // '=keyword' are the entries named exactly so
+    if(rtk_vocab_copy(input->primitive, buf) == -1)
+        return 0;
+    rtk_norm(buf, 0);
+    if((word = rtk_vocab_find(buf)) == -1)
+        return 0;
+    
+    for(x=rtk_named_start[word]; x<rtk_named_start[word+1]; x++)
+    {
+        e = rtk_named[x];
+        rtk_result_add(c, e, 1);
+    }
+    input->found = c->result_count > 0;
+    
+    return c->result_count;
+}
+
+void rtk_plan_order(struct rtkcontext *c, int terms)
+{
+    int x, y, tmp, positive;
+    
+    // included terms cheapest first, then excluded ones
+    for(x=0, positive=0; x<terms; x++)
+        if(!c->terms[x].exclude)
+            c->term_order[positive++] = x;
+    for(x=0, y=positive; x<terms; x++)
+        if(c->terms[x].exclude)
+            c->term_order[y++] = x;
+    
+    for(x=1; x<positive; x++)
+        for(y=x; y>0 && c->terms[c->term_order[y]].size < c->terms[c->term_order[y-1]].size; y--)
+        {
+            tmp = c->term_order[y];
+            c->term_order[y] = c->term_order[y-1];
+            c->term_order[y-1] = tmp;
+        }
+}
+
+struct rtkresult* rtk_context_lookup(struct rtkcontext *c, int argc, struct rtkinput *argv)
+{
+    struct rtkterm *t;
+    int *set;
+    int x, n, e, terms, count, positive, empty;
+    
+    if(!argc)
+        return 0;
+    
+    rtk_context_fit(c);
+    if(c->result_count)
+        rtk_result_reset(c);
+    
+    // a single frame number or exact keyword
+    // is answered by the indexes alone
+    if(argc == 1 && (argv[0].primitive[0] == '#'
+        || (argv[0].primitive[0] == '=' && argv[0].primitive[1])))
+    {
+        c->term_inputs = 0;
+        return rtk_lookup_direct(c, argv) ? c->results : 0;
+    }
+    
+    terms = rtk_query(c, argc, argv);
+    rtk_plan_order(c, terms);
+    
+    // intersect the candidate sets of all included terms
+    // each filtered by the times its word is required,
+    // then remove those of all excluded terms
+    // stop at the term leaving nothing, terms not evaluated
+    // count as found if their words are known
+    for(x=0, count=0, positive=0, empty=-1; x<terms; x++)
+    {
+        t = &c->terms[c->term_order[x]];
+        t->found = t->size > 0;
+        if(empty != -1 || (t->exclude && !positive))
+            continue;
+        
+        if(positive && count*PROBE_RATIO < t->size)
+        {
+            count = rtk_set_probe(c, c->set, count, t, !t->exclude);
+            positive += !t->exclude;
+        }
+        else
+        {
+            n = t->size ? rtk_term_set(c, t, t->times, &set) : 0;
+            
+            if(t->exclude)
+                count = rtk_set_minus(c->set, count, set, n);
+            else if(!positive++)
+            {
+                if(n)
+                    memcpy(c->set, set, n*sizeof(int));
+                count = n;
+            }
+            else
+                count = rtk_set_and(c->set, count, set, n);
+        }
+        
+        plan("plan: %s%s (%i) %i left\n", t->exclude ? "" : x ? "and " : "",
+            argv[t->input].primitive, t->size, count);
+        
+        if(!count)
+        {
+            empty = c->term_order[x];
+            t->found = 0;
+        }
+    }
+    
+    if(empty != -1 && empty != c->term_order[terms-1])
+        plan("plan: stopped at %s\n", argv[c->terms[empty].input].primitive);
+    
+    for(x=0; x<argc; x++)
+        argv[x].found = c->terms[c->term_of[x]].found;
+    
+    for(x=0; x<count; x++)
+    {
+        e = c->set[x];
+        if(rtk_numbers[e])
+            rtk_result_add(c, e, rtk_set_named(c, e, terms));
+    }
+    
+    if(!c->result_count)
+        return 0;
+    return c->results;
+}
+
+struct rtkresult* rtk_lookup(int argc, struct rtkinput *argv)
+{
+    return rtk_context_lookup(&rtk_context, argc, argv);
+}
+
+struct rtkresult* rtk_context_partial(struct rtkcontext *c, int argc, struct rtkinput *argv)
+{
+    struct rtkterm *t;
+    int *set;
+    int x, y, n, e, times, terms, touched;
+    
+    if(!argc)
+        return 0;
+    
+    rtk_context_fit(c);
+    if(c->result_count)
+        rtk_result_reset(c);
+    
+    terms = rtk_query(c, argc, argv);
+    
+    // kanji containing an excluded primitive are marked first
+    touched = 0;
+    for(x=0; x<terms; x++)
+    {
+        t = &c->terms[x];
+        if(!t->exclude || !t->count)
+            continue;
+        
+        n = rtk_term_set(c, t, t->times, &set);
+        t->found = n > 0;
+        for(y=0; y<n; y++)
+            if(!c->match_count[set[y]])
+            {
+                c->match_count[set[y]] = -1;
+                c->touched[touched++] = set[y];
+            }
+    }
+    
+    // count for every other kanji the number of primitives whose
+    // candidate set contains it, a repeated term counts as
+    // often as the kanji contains its word
+    for(x=0; x<terms; x++)
+    {
+        t = &c->terms[x];
+        if(t->exclude || !t->count)
+            continue;
+        
+        n = rtk_term_set(c, t, 1, &set);
+        t->found = n > 0;
+        for(y=0; y<n; y++)
+        {
+            e = set[y];
+            if(c->match_count[e] < 0)
+                continue;
+            times = t->times > 1 ? rtk_term_times(c, e, t) : 1;
+            if(!c->match_count[e])
+                c->touched[touched++] = e;
+            c->match_count[e] += times < t->times ? times : t->times;
+        }
+    }
+    
+    for(x=0; x<argc; x++)
+        argv[x].found = c->terms[c->term_of[x]].found;
+    
+    // ordered by rtk_lookup_rank
+    for(x=0; x<touched; x++)
+    {
+        e = c->touched[x];
+        if(rtk_numbers[e] && c->match_count[e] > 0)
+        {
+            rtk_result_add(c, e, 0);
+            c->results[c->result_count-1].partial = c->match_count[e];
+        }
+        c->match_count[e] = 0;
+    }
+    
+    if(!c->result_count)
+        return 0;
+    return c->results;
+}
+
+struct rtkresult* rtk_lookup_partial(int argc, struct rtkinput *argv)
+{
+    return rtk_context_partial(&rtk_context, argc, argv);
+}
+
+int rtk_rank_cmp(const struct rtkresult *a, const struct rtkresult *b)
+{
+    unsigned int fa, fb;
+    
+    // kanjis whose meaning is a primitive first, then most primitives
+    // found, then most frequent, then frame number
+    if(a->allot != b->allot)
+        return b->allot - a->allot;
+    if(a->partial != b->partial)
+        return b->partial - a->partial;
+    
+    fa = a->id < rtk_entry_count ? rtk_freq[a->id] : 0;
+    fb = b->id < rtk_entry_count ? rtk_freq[b->id] : 0;
+    if(fa != fb)
+        return (fb > fa) - (fb < fa);
+    
+    // entries sharing a number keep dictionary order
+    if(a->number != b->number)
+        return (a->number > b->number) - (a->number < b->number);
+    return a->id - b->id;
+}
+
+int rtk_result_cmp(const void *a, const void *b)
+{
+    return rtk_rank_cmp(a, b);
+}
+
+void rtk_rank_sift(struct rtkresult *heap, int count, int x)
+{
+    struct rtkresult tmp;
+    int child;
+    
+    // the worst result stays at the root
+    while((child = 2*x+1) < count)
+    {
+        if(child+1 < count && rtk_rank_cmp(&heap[child+1], &heap[child]) > 0)
+            child++;
+        if(rtk_rank_cmp(&heap[child], &heap[x]) <= 0)
+            break;
+        tmp = heap[x];
+        heap[x] = heap[child];
+        heap[child] = tmp;
+        x = child;
+    }
+}
+
+void rtk_lookup_rank(struct rtkresult *result, int count, int ranked, int upto)
+{
+    struct rtkresult *heap = result+ranked, tmp;
+    int x, k;
+    
+    if(upto > count)
+        upto = count;
+    if((k = upto-ranked) <= 0)
+        return;
+    
+    // the results before ranked are in place already
+    // keep the best k of the rest in a bounded heap
+    // and only sort those, the rest is left for later pages
+    if(upto < count)
+    {
+        for(x=k/2-1; x>=0; x--)
+            rtk_rank_sift(heap, k, x);
+        for(x=upto; x<count; x++)
+            if(rtk_rank_cmp(&result[x], &heap[0]) < 0)
+            {
+                tmp = result[x];
+                result[x] = heap[0];
+                heap[0] = tmp;
+                rtk_rank_sift(heap, k, 0);
+            }
+    }
+    
+    qsort(heap, k, sizeof(struct rtkresult), rtk_result_cmp);
+}
+
+int rtk_decompose_entry(int id, char *buf, int size)
+{
+    int x, d, len, pos;
+    
+    // every primitive followed by the decomposition of
+    // the first entry defining it, if that comes before,
+    // so the ids only decrease and there are no cycles
+    for(x=rtk_prim_start[id], pos=0, buf[0]=0; x<rtk_prim_start[id+1]; x++)
+    {
+        if(rtk_prims[x] == -1)
+            continue;
+        
+        len = snprintf(buf+pos, size-pos, "%s%s", pos ? " + " : "", rtk_word(rtk_prims[x]));
+        if(len >= size-pos)
+            return -1;
+        pos += len;
+        
+        d = rtk_word_def[rtk_prims[x]];
+        if(d == -1 || d >= id || rtk_prim_start[d] == rtk_prim_start[d+1])
+            continue;
+        
+        if(size-pos < 4)
+            return -1;
+        memcpy(buf+pos, " (", 2);
+        if((len = rtk_decompose_entry(d, buf+pos+2, size-pos-3)) == -1)
+            return -1;
+        if(!len)
+        {
+            buf[pos] = 0;
+            continue;
+        }
+        pos += len+2;
+        buf[pos++] = ')';
+        buf[pos] = 0;
+    }
+    
+    return pos;
+}
+
+int rtk_decompose(int id, char *buf, int size)
+{
+    int len;
+    
+    if(id < 0 || id >= rtk_entry_count || size < 1)
+        return -1;
+    
+    if((len = rtk_decompose_entry(id, buf, size)) != -1)
+        return len;
+    
+    // what fits is kept, the cut marked
+    if(size < 4)
+        return -1;
+    if((len = strlen(buf)) > size-4)
+        len = size-4;
+    strcpy(buf+len, "...");
+    
+    return len+3;
+}
+
+int rtk_entry_named(int e, int word)
+{
+    int x;
+    
+    for(x=rtk_name_start[e]+rtk_skip[e]; x<rtk_name_start[e+1]; x++)
+        if(rtk_names[x] == word)
+            return 1;
+    return 0;
+}
+
+int rtk_explain_path(struct rtkcontext *c, int e, int word, char *buf, int size)
+{
+    int *words, *preds, *found, x, f, p, len, pos, count;
+    unsigned char *times;
+    
+    // from the kanji over the primitive leading to the word and
+    // the entry defining that primitive, following the predecessor
+    // stored for the word until it is a primitive or name itself
+    if((pos = snprintf(buf, size, "%s", rtk_string(rtk_kanji[e]))) >= size)
+        return -1;
+    
+    while(1)
+    {
+        count = rtk_contains(c, e, &words, &times, &preds);
+        if(!(found = bsearch(&word, words, count, sizeof(int), rtk_int_cmp)))
+            return -1;
+        
+        if((f = preds[found-words]) == e)
+        {
+            len = snprintf(buf+pos, size-pos, " > %s", rtk_word(word));
+            return len < size-pos ? pos+len : -1;
+        }
+        
+        for(x=rtk_prim_start[e], p=-1; x<rtk_prim_start[e+1] && p == -1; x++)
+            if(rtk_prims[x] != -1 && rtk_entry_named(f, rtk_prims[x]))
+                p = rtk_prims[x];
+        if(p == -1)
+            return -1;
+        
+        len = snprintf(buf+pos, size-pos, " > %s (%s)", rtk_word(p), rtk_string(rtk_kanji[f]));
+        if(len >= size-pos)
+            return -1;
+        pos += len;
+        
+        // the word is another name of the defining entry
+        if(rtk_entry_named(f, word))
+        {
+            if(p == word)
+                return pos;
+            len = snprintf(buf+pos, size-pos, " = %s", rtk_word(word));
+            return len < size-pos ? pos+len : -1;
+        }
+        
+        e = f;
+    }
+}
+
+int rtk_context_explain(struct rtkcontext *c, int id, int input, char *buf, int size)
+{
+    struct rtkterm *t;
+    int *words, *preds, x, best, count, len;
+    unsigned char *times;
+    
+    if(id < 0 || id >= rtk_entry_count || input < 0 || input >= c->term_inputs || size < 1)
+        return -1;
+    
+    // excluded primitives are not contained, nothing to explain
+    rtk_context_fit(c);
+    t = &c->terms[c->term_of[input]];
+    buf[0] = 0;
+    if(t->exclude)
+        return 0;
+    
+    // named by the primitive of the last lookup
+    for(x=rtk_name_start[id]; x<rtk_name_start[id+1]; x++)
+        if(rtk_term_has(c, t, rtk_names[x]))
+        {
+            len = snprintf(buf, size, "%s = %s", rtk_string(rtk_kanji[id]), rtk_word(rtk_names[x]));
+            return len < size ? len : -1;
+        }
+    
+    // else the word matching it that is contained most often
+    count = rtk_contains(c, id, &words, &times, &preds);
+    for(x=0, best=-1; x<count; x++)
+        if(rtk_term_has(c, t, words[x]) && (best == -1 || times[x] > times[best]))
+            best = x;
+    if(best == -1)
+        return 0;
+    
+    return rtk_explain_path(c, id, words[best], buf, size);
+}
+
+int rtk_lookup_explain(int id, int input, char *buf, int size)
+{
+    return rtk_context_explain(&rtk_context, id, input, buf, size);
 }
@@ -23,6 +23,15 @@
 #ifndef __LOOKUP_H__
 #define __LOOKUP_H__
 
+#define RTK_WORD_LEN 64
+#define RTK_SEGMENT_LEN 64
+#define RTK_SEGMENT_MAX 16
+#define RTK_STATS_HIST 16
+#define RTK_STATS_TOP 10
+#define RTK_STATS_PHASES 8
+
+#define rtk_segment_primitive(s, n) ((s)->buf+(s)->segment[n].primitive)
+
 struct rtkinput
 {
     char found, *primitive;
@@ -32,10 +41,69 @@ struct rtkresult
 {
     unsigned int number;
     char *kanji, *meaning;
+    int partial, allot, id;
+};
+
+struct rtkmemstat
+{
+    const char *component;
+    unsigned long bytes;
 };
 
-int rtk_lookup_init(const char *file);
+struct rtkstats
+{
+    int entries, numbered, words, primitives;
+    int fanout[RTK_STATS_HIST], depth[RTK_STATS_HIST];
+    int closures, closure_size[RTK_STATS_TOP];
+    const char *closure_kanji[RTK_STATS_TOP], *closure_meaning[RTK_STATS_TOP];
+    int orphan_count, unparsable_count;
+    const int *orphans;
+    const char **unparsable, *phase[RTK_STATS_PHASES];
+    double phase_ms[RTK_STATS_PHASES];
+};
+
+struct rtksegment
+{
+    int start, len, primitive;
+};
+
+struct rtksegmentation
+{
+    int count;
+    struct rtksegment segment[RTK_SEGMENT_MAX];
+    char buf[2*RTK_SEGMENT_LEN+2*RTK_SEGMENT_MAX];
+};
+
+struct rtkcontext;
+
+#ifndef IBUS_RTK
+extern int rtk_verbose;
+#endif
+
+int rtk_lookup_init(int count, const char **files);
+int rtk_lookup_reload();
 void rtk_lookup_free();
+int rtk_lookup_memstats(struct rtkmemstat *stats, int max);
+int rtk_lookup_stats(struct rtkstats *stats);
 struct rtkresult* rtk_lookup(int argc, struct rtkinput *argv);
+struct rtkresult* rtk_lookup_scan(int argc, struct rtkinput *argv);
+struct rtkresult* rtk_lookup_partial(int argc, struct rtkinput *argv);
+struct rtkcontext* rtk_context_new();
+void rtk_context_free(struct rtkcontext *c);
+struct rtkresult* rtk_context_lookup(struct rtkcontext *c, int argc, struct rtkinput *argv);
+struct rtkresult* rtk_context_partial(struct rtkcontext *c, int argc, struct rtkinput *argv);
+int rtk_context_explain(struct rtkcontext *c, int id, int input, char *buf, int size);
+void rtk_lookup_rank(struct rtkresult *result, int count, int ranked, int upto);
+int rtk_segment(const char *str, struct rtksegmentation *seg, int max);
+int rtk_vocab_known(const char *str);
+int rtk_vocab_norm(const char *str, char *buf);
+int rtk_vocab_complete(const char *str, int *first);
+int rtk_vocab_pattern(const char *str, const int **words);
+const char* rtk_vocab_word(int id);
+int rtk_kanji_find(const char *kanji);
+int rtk_decompose(int id, char *buf, int size);
+int rtk_lookup_explain(int id, int input, char *buf, int size);
+int rtk_vocab_query(int id, char *buf, int size);
+int rtk_vocab_fuzzy(const char *str, char *buf, int size);
 
 #endif
@@ -28,13 +28,21 @@
 
 static gboolean ibus = FALSE;
 gboolean verbose = FALSE;
-gchar *dict = 0;
+gboolean segment = FALSE;
+gboolean fuzzy = FALSE;
+gboolean explain = FALSE;
+gchar **dicts = 0;
+
+static gchar *default_dicts[] = { PKGDATADIR "/dicts/primitives", NULL };
 
 static const GOptionEntry entries[] =
 {
     { "ibus", 'i', 0, G_OPTION_ARG_NONE, &ibus, "component is executed by ibus", NULL },
     { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "verbose", NULL },
-    { "dict", 'd', 0, G_OPTION_ARG_FILENAME, &dict, "dictionary file", "dict" },
+    { "dict", 'd', 0, G_OPTION_ARG_FILENAME_ARRAY, &dicts, "dictionary file, later ones are layered over earlier ones", "dict" },
+    { "segment", 's', 0, G_OPTION_ARG_NONE, &segment, "segment primitives typed without spaces", NULL },
+    { "fuzzy", 'f', 0, G_OPTION_ARG_NONE, &fuzzy, "correct misspelled primitives on failed lookup", NULL },
+    { "explain", 'e', 0, G_OPTION_ARG_NONE, &explain, "show why the selected kanji matched every primitive", NULL },
     { NULL }
 };
 
@@ -51,6 +59,7 @@ int main(int argc, char *argv[])
     IBusBus *bus;
     IBusFactory *factory;
     IBusComponent *component;
+    guint x;
     
     context = g_option_context_new("- ibus rtk engine");
     g_option_context_add_main_entries(context, entries, "ibus-rtk");
@@ -62,14 +71,15 @@ int main(int argc, char *argv[])
         return -1;
     }
     
-    if(!dict)
-        dict = PKGDATADIR "/dicts/primitives";
+    if(!dicts)
+        dicts = default_dicts;
     
-    if(!g_file_test(dict, G_FILE_TEST_EXISTS))
-    {
-        g_printerr("Failed to find dictionary '%s'\n", dict);
-        return -2;
-    }
+    for(x=0; dicts[x]; x++)
+        if(!g_file_test(dicts[x], G_FILE_TEST_EXISTS))
+        {
+            g_printerr("Failed to find dictionary '%s'\n", dicts[x]);
+            return -2;
+        }
     
     ibus_init();
     
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "lookup.h"
+
+#define DEFAULT_QUERIES 10000
+#define PAGE_SIZE 10
+#define QUERY_MAX 8
+
+// load time, memory and lookup latency for one kanjifile
+// bench.sh runs it over generated dictionaries of growing size
+
+struct query
+{
+    int count;
+    struct rtkinput input[QUERY_MAX];
+};
+
+char **prims;
+int prim_count, prim_cap;
+
+double now()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+long rss()
+{
+    FILE *f;
+    char line[128];
+    long kb = 0;
+    
+    // resident now, the peak would include freed load buffers
+    if(!(f = fopen("/proc/self/status", "r")))
+        return 0;
+    while(fgets(line, sizeof(line), f))
+        if(!strncmp(line, "VmRSS:", 6))
+            kb = atol(line+6);
+    fclose(f);
+    
+    return kb;
+}
+
+int read_prims(const char *file)
+{
+    FILE *f;
+    char *line, *field;
+    size_t n;
+    int x;
+    
+    // the primitives of every entry make realistic queries
+    if(!(f = fopen(file, "r")))
+    {
+        perror("Failed to open kanjifile");
+        return 1;
+    }
+    
+    line = 0;
+    while(getline(&line, &n, f) != -1)
+    {
+        for(x=0, field=line; x<5 && (field = strchr(field, ':')); x++)
+            field++;
+        if(*line == '#' || !field || *field == '-' || *field == '\n')
+            continue;
+        
+        field[strcspn(field, "\n")] = 0;
+        
+        if(prim_count == prim_cap)
+        {
+            prim_cap = prim_cap ? 2*prim_cap : 1024;
+            prims = realloc(prims, prim_cap*sizeof(char*));
+        }
+        prims[prim_count++] = strdup(field);
+    }
+    
+    free(line);
+    fclose(f);
+    
+    return 0;
+}
+
+void make_query(struct query *q, int type)
+{
+    char *prim, *save;
+    
+    q->count = 0;
+    prim = strdup(prims[rand() % prim_count]);
+    
+    // all primitives of a kanji, the first only,
+    // or all plus an unknown one for a partial lookup
+    for(prim=strtok_r(prim, "/", &save); prim && q->count < QUERY_MAX-1; prim=strtok_r(0, "/", &save))
+    {
+        q->input[q->count++].primitive = prim;
+        if(type == 1)
+            break;
+    }
+    if(type == 2)
+        q->input[q->count++].primitive = "unknown";
+}
+
+int double_cmp(const void *a, const void *b)
+{
+    return (*(double*)a > *(double*)b) - (*(double*)a < *(double*)b);
+}
+
+int main(int argc, char *argv[])
+{
+    struct query *queries;
+    struct rtkresult *result;
+    struct rtkstats stats;
+    double start, *lat, sum;
+    long base, mem;
+    int x, count, opt, query_count = DEFAULT_QUERIES;
+    const char *file;
+    
+    while((opt = getopt(argc, argv, "q:")) != -1)
+        switch(opt)
+        {
+        case 'q':
+            query_count = atoi(optarg);
+            break;
+        default:
+            optind = argc;
+        }
+    
+    if(optind != argc-1 || query_count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-q <queries>] <kanjifile>\n", argv[0]);
+        return 1;
+    }
+    file = argv[optind];
+    
+    if(read_prims(file) || !prim_count)
+        return 2;
+    
+    srand(1);
+    queries = malloc(query_count*sizeof(struct query));
+    for(x=0; x<query_count; x++)
+        make_query(&queries[x], x % 3);
+    
+    base = rss();
+    start = now();
+    if(rtk_lookup_init(1, &file))
+        return 2;
+    sum = now()-start;
+    mem = rss()-base;
+    rtk_lookup_stats(&stats);
+    printf("%i\t%.1f\t%li", stats.entries, sum/1e3, mem);
+    
+    // a lookup is done when the engine can show the first page
+    lat = malloc(query_count*sizeof(double));
+    for(x=0, sum=0; x<query_count; x++)
+    {
+        start = now();
+        if((result = rtk_lookup(queries[x].count, queries[x].input))
+            || (queries[x].count > 1 && (result = rtk_lookup_partial(queries[x].count, queries[x].input))))
+        {
+            for(count=0; result[count].kanji; count++);
+            rtk_lookup_rank(result, count, 0, PAGE_SIZE);
+        }
+        lat[x] = now()-start;
+        sum += lat[x];
+    }
+    
+    qsort(lat, query_count, sizeof(double), double_cmp);
+    printf("\t%.1f\t%.1f\t%.1f\t%.1f\n", sum/query_count, lat[query_count/2],
+        lat[query_count*99/100], lat[query_count-1]);
+    
+    rtk_lookup_free();
+    
+    for(x=0; x<query_count; x++)
+        free(queries[x].input[0].primitive);
+    for(x=0; x<prim_count; x++)
+        free(prims[x]);
+    free(queries);
+    free(prims);
+    free(lat);
+    
+    return 0;
+}
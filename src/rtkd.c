@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "lookup.h"
+#include "client.h"
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_DICT PKGDATADIR "/dicts/primitives"
+#define BUF_CAP 256
+
+struct rtkclient
+{
+    int fd, busy, closed;
+    char *buf;
+    uint32_t len, cap;
+    struct rtkclient *next;
+};
+
+struct rtkworker
+{
+    pthread_t thread;
+    struct rtkcontext *context;
+    struct rtkinput *input;
+    char *request, *response;
+    int input_cap, response_cap, response_len;
+    uint32_t request_cap;
+};
+
+
+struct rtkclient **clients;
+struct rtkclient *queue, *queue_tail;
+int client_count, client_cap, wake[2];
+volatile sig_atomic_t running, reload;
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_rwlock_t lookup_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+
+void rtkd_signal()
+{
+    int err = errno;
+    char byte = 0;
+    ssize_t ret;
+    
+    // a signal arriving after the loop checked its flags but before
+    // it polls would wait for the next client, the byte ends the poll,
+    // a full pipe wakes it anyway
+    ret = write(wake[1], &byte, 1);
+    (void)ret;
+    errno = err;
+}
+
+void rtkd_stop(int sig)
+{
+    (void)sig;
+    running = 0;
+    rtkd_signal();
+}
+
+void rtkd_reload(int sig)
+{
+    (void)sig;
+    reload = 1;
+    rtkd_signal();
+}
+
+uint32_t rtkd_frame(struct rtkclient *c)
+{
+    uint32_t size;
+    
+    // length of the first complete request or 0
+    if(c->len < 4)
+        return 0;
+    memcpy(&size, c->buf, 4);
+    size = ntohl(size);
+    
+    return c->len-4 >= size ? size+4 : 0;
+}
+
+void rtkd_append(struct rtkworker *w, const char *format, ...)
+{
+    va_list args;
+    int len;
+    
+    while(1)
+    {
+        va_start(args, format);
+        len = vsnprintf(w->response+w->response_len, w->response_cap-w->response_len, format, args);
+        va_end(args);
+        
+        if(w->response_len+len < w->response_cap)
+            break;
+        
+        w->response_cap = 2*(w->response_len+len+1);
+        w->response = realloc(w->response, w->response_cap);
+    }
+    
+    w->response_len += len;
+}
+
+void rtkd_results(struct rtkworker *w, struct rtkresult *result, const char *type, int partial)
+{
+    int count;
+    
+    for(count=0; result[count].kanji; count++);
+    rtk_lookup_rank(result, count, 0, count);
+    
+    for(; result->kanji; result++)
+    {
+        rtkd_append(w, "%s\t%u\t%s\t%s", type, result->number, result->kanji, result->meaning);
+        if(partial)
+            rtkd_append(w, "\t%i", result->partial);
+        rtkd_append(w, "\n");
+    }
+}
+
+void rtkd_lookup(struct rtkworker *w, char *request, uint32_t size)
+{
+    struct rtkresult *result;
+    uint32_t y;
+    int x, count;
+    
+    // split the request into primitives
+    for(y=0, count=1; y<size; y++)
+        if(request[y] == '\n')
+            count++;
+    if(count > w->input_cap)
+    {
+        w->input_cap = 2*count;
+        w->input = realloc(w->input, w->input_cap*sizeof(struct rtkinput));
+    }
+    
+    request[size] = 0;
+    w->input[0].primitive = request;
+    for(y=0, count=1; y<size; y++)
+        if(request[y] == '\n')
+        {
+            request[y] = 0;
+            w->input[count++].primitive = request+y+1;
+        }
+    if(!size)
+        count = 0;
+    
+    w->response_len = 0;
+    rtkd_append(w, "%4s", "");
+    
+    // the index is only read, lookups run in parallel
+    // each in the scratch of its worker until a reload
+    pthread_rwlock_rdlock(&lookup_lock);
+    
+    if((result = rtk_context_lookup(w->context, count, w->input)))
+        rtkd_results(w, result, "found", 0);
+    else
+    {
+        for(x=0; x<count; x++)
+            if(!w->input[x].found)
+                rtkd_append(w, "notfound\t%s\n", w->input[x].primitive);
+        
+        if(count > 1 && (result = rtk_context_partial(w->context, count, w->input)))
+            rtkd_results(w, result, "partial", 1);
+    }
+    
+    pthread_rwlock_unlock(&lookup_lock);
+}
+
+int rtkd_write(int fd, const char *buf, size_t len)
+{
+    struct pollfd p = {fd, POLLOUT, 0};
+    ssize_t ret;
+    
+    while(len)
+    {
+        if((ret = write(fd, buf, len)) == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                poll(&p, 1, -1);
+            else if(errno != EINTR)
+                return -1;
+            continue;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    
+    return 0;
+}
+
+void* rtkd_worker(void *data)
+{
+    struct rtkworker *w = data;
+    struct rtkclient *c;
+    uint32_t size, frame;
+    char byte = 0;
+    
+    while(1)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while(running && !queue)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if(!running)
+        {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        c = queue;
+        if(!(queue = c->next))
+            queue_tail = 0;
+        pthread_mutex_unlock(&queue_lock);
+        
+        // the event loop leaves busy clients alone
+        frame = rtkd_frame(c);
+        size = frame-4;
+        if(size+1 > w->request_cap)
+        {
+            w->request_cap = 2*(size+1);
+            w->request = realloc(w->request, w->request_cap);
+        }
+        memcpy(w->request, c->buf+4, size);
+        memmove(c->buf, c->buf+frame, c->len-frame);
+        c->len -= frame;
+        
+        rtkd_lookup(w, w->request, size);
+        
+        size = htonl(w->response_len-4);
+        memcpy(w->response, &size, 4);
+        if(rtkd_write(c->fd, w->response, w->response_len) == -1)
+            c->closed = 1;
+        
+        pthread_mutex_lock(&queue_lock);
+        c->busy = 0;
+        pthread_mutex_unlock(&queue_lock);
+        
+        if(write(wake[1], &byte, 1) == -1 && errno != EAGAIN)
+            perror("Failed to wake event loop");
+    }
+    
+    return 0;
+}
+
+void rtkd_queue(struct rtkclient *c)
+{
+    // one request per client at a time keeps responses in order
+    pthread_mutex_lock(&queue_lock);
+    c->busy = 1;
+    c->next = 0;
+    if(queue_tail)
+        queue_tail->next = c;
+    else
+        queue = c;
+    queue_tail = c;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+int rtkd_busy(struct rtkclient *c)
+{
+    int busy;
+    
+    pthread_mutex_lock(&queue_lock);
+    busy = c->busy;
+    pthread_mutex_unlock(&queue_lock);
+    
+    return busy;
+}
+
+void rtkd_client_add(int fd)
+{
+    struct rtkclient *c;
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    
+    if(client_count == client_cap)
+    {
+        client_cap = client_cap ? 2*client_cap : 16;
+        clients = realloc(clients, client_cap*sizeof(struct rtkclient*));
+    }
+    
+    c = calloc(1, sizeof(struct rtkclient));
+    c->fd = fd;
+    c->cap = BUF_CAP;
+    c->buf = malloc(c->cap);
+    clients[client_count++] = c;
+}
+
+void rtkd_client_remove(int x)
+{
+    close(clients[x]->fd);
+    free(clients[x]->buf);
+    free(clients[x]);
+    clients[x] = clients[--client_count];
+}
+
+int rtkd_client_read(struct rtkclient *c)
+{
+    ssize_t ret;
+    uint32_t size;
+    
+    if(c->len == c->cap)
+    {
+        c->cap *= 2;
+        c->buf = realloc(c->buf, c->cap);
+    }
+    
+    if((ret = read(c->fd, c->buf+c->len, c->cap-c->len)) == -1)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    if(!ret)
+        return -1;
+    c->len += ret;
+    
+    // refuse requests larger than any sane query
+    if(c->len >= 4)
+    {
+        memcpy(&size, c->buf, 4);
+        if(ntohl(size) > RTK_FRAME_MAX)
+            return -1;
+    }
+    
+    if(rtkd_frame(c))
+        rtkd_queue(c);
+    
+    return 0;
+}
+
+int rtkd_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+    
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    
+    // a stale socket of a previous run is replaced
+    // a socket somebody still listens on is not
+    if((fd = rtk_client_connect(path)) != -1)
+    {
+        fprintf(stderr, "Already running on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+    
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        perror("Failed to create socket");
+        return -1;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 64) == -1)
+    {
+        perror("Failed to listen on socket");
+        close(fd);
+        return -1;
+    }
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    
+    return fd;
+}
+
+void rtkd_loop(int listen_fd)
+{
+    struct pollfd *fds = 0;
+    struct rtkclient **polled = 0;
+    int x, n, fd, cap = 0;
+    char drain[64];
+    
+    while(running)
+    {
+        if(client_count+2 > cap)
+        {
+            cap = 2*(client_count+2);
+            fds = realloc(fds, cap*sizeof(struct pollfd));
+            polled = realloc(polled, cap*sizeof(struct rtkclient*));
+        }
+        
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = wake[0];
+        fds[1].events = POLLIN;
+        
+        // clients with a request in progress are not polled
+        for(x=0, n=2; x<client_count; x++)
+        {
+            if(rtkd_busy(clients[x]))
+                continue;
+            fds[n].fd = clients[x]->fd;
+            fds[n].events = POLLIN;
+            polled[n++] = clients[x];
+        }
+        
+        // edited dictionary layers are picked up on SIGHUP
+        if(reload)
+        {
+            reload = 0;
+            pthread_rwlock_wrlock(&lookup_lock);
+            rtk_lookup_reload();
+            pthread_rwlock_unlock(&lookup_lock);
+            fflush(stdout);
+        }
+        
+        if(poll(fds, n, -1) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("Failed to poll");
+            break;
+        }
+        
+        if(fds[1].revents & POLLIN)
+            while(read(wake[0], drain, sizeof(drain)) > 0);
+        
+        for(x=2; x<n; x++)
+        {
+            if(fds[x].revents & POLLIN)
+            {
+                if(rtkd_client_read(polled[x]) == -1)
+                    polled[x]->closed = 1;
+            }
+            else if(fds[x].revents & (POLLHUP|POLLERR))
+                polled[x]->closed = 1;
+        }
+        
+        // drop closed clients, queue requests sent in one go
+        for(x=0; x<client_count; x++)
+        {
+            if(rtkd_busy(clients[x]))
+                continue;
+            if(clients[x]->closed)
+                rtkd_client_remove(x--);
+            else if(rtkd_frame(clients[x]))
+                rtkd_queue(clients[x]);
+        }
+        
+        if(fds[0].revents & POLLIN)
+            while((fd = accept(listen_fd, 0, 0)) != -1)
+                rtkd_client_add(fd);
+    }
+    
+    free(fds);
+    free(polled);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = 0, *dict = DEFAULT_DICT, **dicts = &dict;
+    struct rtkworker *workers;
+    sigset_t signals, old;
+    int opt, x, fd, dict_count = 1, worker_count = DEFAULT_WORKERS;
+    
+    while((opt = getopt(argc, argv, "s:w:")) != -1)
+        switch(opt)
+        {
+        case 's':
+            path = optarg;
+            break;
+        case 'w':
+            if((worker_count = atoi(optarg)) > 0)
+                break;
+            // fall through
+        default:
+            fprintf(stderr, "Usage: %s [-s <socket>] [-w <workers>] [<kanjifile> ...]\n", argv[0]);
+            return 1;
+        }
+    
+    // further kanjifiles are layered over the first
+    if(optind < argc)
+    {
+        dicts = (const char**)argv+optind;
+        dict_count = argc-optind;
+    }
+    if(!path)
+        path = rtk_client_socket();
+    
+    if(rtk_lookup_init(dict_count, dicts))
+        return 2;
+    
+    if((fd = rtkd_listen(path)) == -1)
+    {
+        rtk_lookup_free();
+        return 3;
+    }
+    
+    if(pipe(wake) == -1)
+    {
+        perror("Failed to create pipe");
+        close(fd);
+        unlink(path);
+        rtk_lookup_free();
+        return 3;
+    }
+    fcntl(wake[0], F_SETFL, fcntl(wake[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, fcntl(wake[1], F_GETFL) | O_NONBLOCK);
+    
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, rtkd_stop);
+    signal(SIGTERM, rtkd_stop);
+    signal(SIGHUP, rtkd_reload);
+    
+    // signals go to the event loop, not to the workers
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, &old);
+    
+    running = 1;
+    workers = calloc(worker_count, sizeof(struct rtkworker));
+    for(x=0; x<worker_count; x++)
+    {
+        workers[x].context = rtk_context_new();
+        pthread_create(&workers[x].thread, 0, rtkd_worker, &workers[x]);
+    }
+    
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+    
+    printf("Listening on %s\n", path);
+    fflush(stdout);
+    
+    rtkd_loop(fd);
+    
+    pthread_mutex_lock(&queue_lock);
+    running = 0;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    
+    for(x=0; x<worker_count; x++)
+    {
+        pthread_join(workers[x].thread, 0);
+        rtk_context_free(workers[x].context);
+        free(workers[x].input);
+        free(workers[x].request);
+        free(workers[x].response);
+    }
+    free(workers);
+    
+    while(client_count)
+        rtkd_client_remove(0);
+    free(clients);
+    
+    close(fd);
+    unlink(path);
+    close(wake[0]);
+    close(wake[1]);
+    rtk_lookup_free();
+    
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lookup.h"
+
+#define FUZZ_WORDS 8
+
+// libFuzzer target for the kanjifile parser and the index built from it,
+// every input is loaded as a dictionary and queried with its own words,
+// built with --enable-fuzz
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+    static char path[] = "/tmp/rtkfuzz.XXXXXX";
+    static int fd = -1;
+    const char *file = path;
+    struct rtkinput input[2];
+    struct rtkstats st;
+    struct rtksegmentation seg;
+    char prefix[64];
+    int x;
+    
+    // the loader reads files only, one is rewritten for every input
+    if(fd == -1 && (fd = mkstemp(path)) == -1)
+        abort();
+    if(ftruncate(fd, 0) || (size && pwrite(fd, data, size, 0) != (ssize_t)size))
+        abort();
+    
+    if(rtk_lookup_init(1, &file))
+        return 0;
+    
+    if(!rtk_lookup_stats(&st))
+        for(x=0; x<st.words && x<FUZZ_WORDS; x++)
+        {
+            input[0].primitive = (char*)rtk_vocab_word(x);
+            input[1].primitive = (char*)rtk_vocab_word(st.words-1-x);
+            rtk_lookup(2, input);
+            rtk_lookup_scan(2, input);
+            rtk_lookup_partial(2, input);
+            
+            snprintf(prefix, sizeof(prefix), "%.2s*", input[0].primitive);
+            input[0].primitive = prefix;
+            rtk_lookup(1, input);
+            rtk_lookup_scan(1, input);
+            rtk_segment(input[1].primitive, &seg, 1);
+        }
+    
+    rtk_lookup_free();
+    
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_PRIMITIVES 200
+#define DEFAULT_DEPTH 6
+#define DEFAULT_SEED 1
+#define WORD_LEN 32
+#define PRIM_MAX 5
+
+// synthetic dictionaries in the primitives format to measure
+// how lookups scale with the number of kanji
+
+const char *syllables[] =
+{
+    "ka", "ki", "ku", "ke", "ko", "sa", "shi", "su", "se", "so",
+    "ta", "chi", "tsu", "te", "to", "na", "ni", "nu", "ne", "no",
+    "ha", "hi", "fu", "he", "ho", "ma", "mi", "mu", "me", "mo",
+    "ya", "yu", "yo", "ra", "ri", "ru", "re", "ro", "wa", "n"
+};
+
+#define SYLLABLES (sizeof(syllables)/sizeof(char*))
+
+unsigned int seed, mutate;
+
+unsigned int rnd(unsigned int max)
+{
+    // xorshift, the same seed gives the same dictionary
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % max;
+}
+
+void word(unsigned int n, char *buf)
+{
+    // every number gets its own word
+    *buf = 0;
+    do
+    {
+        strcat(buf, syllables[n % SYLLABLES]);
+        n /= SYLLABLES;
+    }
+    while(n);
+}
+
+void spelling(char *buf)
+{
+    // the forms the parser normalizes to the same keyword
+    if(!mutate)
+        return;
+    switch(rnd(8))
+    {
+    case 0:
+        buf[0] -= 32;
+        break;
+    case 1:
+        strcat(buf, "s");
+        break;
+    case 2:
+        strcat(buf, " [comment]");
+        break;
+    }
+}
+
+void glyph(unsigned int n, char *buf)
+{
+    unsigned int c;
+    
+    // cjk unified ideographs, then extension b
+    c = n < 0x5200 ? 0x4e00+n : 0x20000+n-0x5200;
+    
+    if(c < 0x10000)
+        sprintf(buf, "%c%c%c", 0xe0|c>>12, 0x80|(c>>6&0x3f), 0x80|(c&0x3f));
+    else
+        sprintf(buf, "%c%c%c%c", 0xf0|c>>18, 0x80|(c>>12&0x3f), 0x80|(c>>6&0x3f), 0x80|(c&0x3f));
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int count, prims = DEFAULT_PRIMITIVES, depth = DEFAULT_DEPTH;
+    unsigned char *level;
+    unsigned int x, y, n, pick, total;
+    char kanji[8], name[WORD_LEN+16], alt[WORD_LEN+16];
+    int opt;
+    
+    seed = DEFAULT_SEED;
+    
+    while((opt = getopt(argc, argv, "d:mp:s:")) != -1)
+        switch(opt)
+        {
+        case 'm':
+            mutate = 1;
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'p':
+            prims = atoi(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            optind = argc;
+        }
+    
+    if(optind != argc-1 || !(count = atoi(argv[optind])) || !prims || !depth || !seed)
+    {
+        fprintf(stderr, "Usage: %s [-m] [-p <primitives>] [-d <depth>] [-s <seed>] <kanji>\n", argv[0]);
+        return 1;
+    }
+    
+    total = prims+count;
+    level = calloc(total, 1);
+    
+    printf("# number:skip:kanji:meaning:alternatives:primitives\n");
+    
+    // numberless primitives at the bottom, mutated ones
+    // partly aliased without a kanji of their own
+    for(x=0; x<prims; x++)
+    {
+        glyph(count+x, kanji);
+        word(x, name);
+        if(mutate && !rnd(3))
+        {
+            word(total+2*count+x, alt);
+            printf("-:0:-:%s:%s:-\n", name, alt);
+        }
+        else
+            printf("-:0:%s:%s:-:-\n", kanji, name);
+    }
+    
+    // every kanji is built from primitives and earlier kanji
+    // no deeper than the given depth
+    for(x=0; x<count; x++)
+    {
+        // mutated dictionaries also hold lines the parser skips,
+        // other skip counts, placeholders and kanji without primitives
+        if(mutate && !rnd(50))
+            printf("%u:broken\n", x+1);
+        
+        glyph(x, kanji);
+        word(prims+x, name);
+        spelling(name);
+        printf("%u:%u:%s:%s:", x+1, mutate ? rnd(4) : 1+rnd(4), kanji, name);
+        
+        if(!rnd(4))
+        {
+            word(total+x, alt);
+            spelling(alt);
+            printf("%s", alt);
+            
+            // names after a placeholder are dropped by the loaders
+            if(mutate && !rnd(4))
+            {
+                printf("/-");
+                if(rnd(2))
+                {
+                    word(total+count+x, alt);
+                    printf("/%s", alt);
+                }
+            }
+            printf(":");
+        }
+        else
+            printf("-:");
+        
+        if(mutate && !rnd(20))
+        {
+            printf("-\n");
+            continue;
+        }
+        
+        n = 2+rnd(PRIM_MAX-1);
+        for(y=0; y<n; y++)
+        {
+            // earlier kanji are preferred the further along
+            do
+                pick = x && rnd(3) ? prims+rnd(x) : rnd(prims);
+            while(level[pick] >= depth);
+            
+            if(level[pick]+1 > level[prims+x])
+                level[prims+x] = level[pick]+1;
+            
+            word(pick, name);
+            spelling(name);
+            printf("%s%s", y ? "/" : "", name);
+        }
+        printf("\n");
+    }
+    
+    free(level);
+    
+    return 0;
+}
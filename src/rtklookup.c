@@ -22,43 +22,659 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "lookup.h"
+#include "client.h"
+
+#define DECOMPOSE_LEN 1024
+#define MEMSTAT_MAX 32
+#define CHECK_QUERIES 10000
+#define CHECK_TERMS 3
+#define CHECK_LEN 96
+#define CHECK_SHOW 8
+
+unsigned int check_seed = 1;
+unsigned int **check_memo;
+int *check_memo_count;
+
+int connect_lookup(const char *path, int argc, char **argv)
+{
+    char *response, *line, *next, *field[5];
+    unsigned int len;
+    int fd, x;
+    
+    if(!path)
+        path = rtk_client_socket();
+    
+    if((fd = rtk_client_connect(path)) == -1)
+    {
+        perror("Failed to connect to daemon");
+        return 2;
+    }
+    
+    if(rtk_client_lookup(fd, argc, argv, &response, &len) == -1)
+    {
+        perror("Failed to look up");
+        close(fd);
+        return 2;
+    }
+    close(fd);
+    
+    // same output as a local lookup
+    for(line=response; *line; line=next)
+    {
+        if((next = strchr(line, '\n')))
+            *next++ = 0;
+        else
+            next = line+strlen(line);
+        
+        for(x=0, field[0]=line; x<4 && (field[x+1] = strchr(field[x], '\t')); x++)
+            *field[x+1]++ = 0;
+        
+        if(!strcmp(field[0], "found") && x >= 3)
+            printf("found: [%s] %s %s\n", field[1], field[2], field[3]);
+        else if(!strcmp(field[0], "partial") && x >= 4)
+            printf("partial: [%s] %s %s (%s/%i)\n", field[1], field[2], field[3], field[4], argc);
+        else if(!strcmp(field[0], "notfound") && x >= 1)
+            printf("not found: %s\n", field[1]);
+    }
+    
+    free(response);
+    
+    return 0;
+}
+
+int memstats(const char *file)
+{
+    struct rtkmemstat stats[MEMSTAT_MAX];
+    struct stat st;
+    unsigned long total;
+    int x, count;
+    
+    if(rtk_lookup_init(1, &file))
+        return 2;
+    
+    // bytes held by every part of the index after loading
+    count = rtk_lookup_memstats(stats, MEMSTAT_MAX);
+    for(x=0, total=0; x<count && x<MEMSTAT_MAX; x++)
+    {
+        printf("%-14s %10lu\n", stats[x].component, stats[x].bytes);
+        total += stats[x].bytes;
+    }
+    printf("%-14s %10lu\n", "total", total);
+    if(!stat(file, &st))
+        printf("%-14s %10lu\n", "file", (unsigned long)st.st_size);
+    
+    rtk_lookup_free();
+    
+    return 0;
+}
+
+void histogram(const char *title, const int *hist)
+{
+    int x, last;
+    
+    for(last=RTK_STATS_HIST-1; last>0 && !hist[last]; last--);
+    
+    printf("%s\n", title);
+    for(x=0; x<=last; x++)
+        printf("  %2i%s %10i\n", x, x == RTK_STATS_HIST-1 ? "+" : " ", hist[x]);
+}
+
+int stats(const char *file)
+{
+    struct rtkstats st;
+    double total;
+    int x;
+    
+    if(rtk_lookup_init(1, &file) || rtk_lookup_stats(&st))
+        return 2;
+    
+    printf("entries        %10i\n", st.entries);
+    printf("numbered       %10i\n", st.numbered);
+    printf("words          %10i\n", st.words);
+    printf("primitives     %10i\n", st.primitives);
+    
+    // primitives per entry and levels of nested primitives
+    histogram("fan-out", st.fanout);
+    histogram("depth", st.depth);
+    
+    printf("largest closures\n");
+    for(x=0; x<st.closures; x++)
+        printf("  %10i %s %s\n", st.closure_size[x], st.closure_kanji[x], st.closure_meaning[x]);
+    
+    printf("orphans        %10i\n", st.orphan_count);
+    for(x=0; x<st.orphan_count; x++)
+        printf("  %s\n", rtk_vocab_word(st.orphans[x]));
+    
+    printf("unparsable     %10i\n", st.unparsable_count);
+    for(x=0; x<st.unparsable_count; x++)
+        printf("  %s\n", st.unparsable[x]);
+    
+    printf("load ms\n");
+    for(x=0, total=0; x<RTK_STATS_PHASES; x++)
+    {
+        printf("  %-12s %10.1f\n", st.phase[x], st.phase_ms[x]);
+        total += st.phase_ms[x];
+    }
+    printf("  %-12s %10.1f\n", "total", total);
+    
+    rtk_lookup_free();
+    
+    return 0;
+}
+
+int check_cmp(const void *a, const void *b)
+{
+    return *(unsigned int*)a < *(unsigned int*)b ? -1 : *(unsigned int*)a > *(unsigned int*)b;
+}
+
+unsigned int check_rnd(unsigned int max)
+{
+    // xorshift like rtkgen, the same seed gives the same queries
+    check_seed ^= check_seed << 13;
+    check_seed ^= check_seed >> 17;
+    check_seed ^= check_seed << 5;
+    return check_seed % max;
+}
+
+void check_term(const char *word, char *buf)
+{
+    int len = strlen(word);
+    
+    // keywords as users type them, both lookups normalize
+    // case, plural 's' and comments and expand prefixes
+    snprintf(buf, CHECK_LEN, "%s", word);
+    switch(check_rnd(6))
+    {
+    case 0:
+        if(buf[0] >= 'a' && buf[0] <= 'z')
+            buf[0] -= 32;
+        break;
+    case 1:
+        strcat(buf, "s");
+        break;
+    case 2:
+        strcat(buf, " [note]");
+        break;
+    case 3:
+        buf[1+check_rnd(len)] = 0;
+        strcat(buf, check_rnd(2) ? "*" : "+");
+        break;
+    }
+}
+
+void check_key(const char *term, char *key)
+{
+    int len, end = strlen(term);
+    
+    // terms typed differently but looked up the same, a query
+    // repeating one asks for kanji containing it more than once,
+    // a prefix may end after a comment
+    for(len=0; term[len] && term[len] != ' '; len++)
+        key[len] = term[len] >= 'A' && term[len] <= 'Z' ? term[len]+32 : term[len];
+    key[len] = 0;
+    if(end && (term[end-1] == '+' || term[end-1] == '*'))
+    {
+        if(len == end)
+            len--;
+        key[len] = '*';
+        key[len+1] = 0;
+    }
+    else if(len && key[len-1] == 's')
+        key[len-1] = 0;
+}
+
+int check_overlap(const char *key1, const char *key2)
+{
+    int len1 = strlen(key1), len2 = strlen(key2);
+    
+    // a prefix covering the other term looks it up a second time
+    if(len1 && key1[len1-1] == '*' && !strncmp(key1, key2, len1-1))
+        return 1;
+    if(len2 && key2[len2-1] == '*' && !strncmp(key1, key2, len2-1))
+        return 1;
+    return !strcmp(key1, key2);
+}
+
+int check_numbers(struct rtkresult *result, unsigned int *numbers)
+{
+    int count;
+    
+    // results are compared as sets
+    for(count=0; result && result[count].kanji; count++)
+        numbers[count] = result[count].number;
+    qsort(numbers, count, sizeof(unsigned int), check_cmp);
+    
+    return count;
+}
+
+void check_diff(const char *title, const unsigned int *a, int na, const unsigned int *b, int nb)
+{
+    int x, y, shown;
+    
+    printf("  %s:", title);
+    for(x=0, y=0, shown=0; x<na && shown<CHECK_SHOW; x++)
+    {
+        while(y < nb && b[y] < a[x])
+            y++;
+        if(y == nb || b[y] != a[x])
+        {
+            printf(" %u", a[x]);
+            shown++;
+        }
+    }
+    printf("%s\n", shown == CHECK_SHOW ? " ..." : "");
+}
+
+int check_and(unsigned int *a, int na, const unsigned int *b, int nb)
+{
+    int x, y, n;
+    
+    for(x=0, y=0, n=0; x<na && y<nb;)
+        if(a[x] < b[y])
+            x++;
+        else if(a[x] > b[y])
+            y++;
+        else
+        {
+            a[n++] = a[x++];
+            y++;
+        }
+    
+    return n;
+}
+
+int check_or(const unsigned int *a, int na, const unsigned int *b, int nb, unsigned int *out)
+{
+    int x, y, n;
+    
+    for(x=0, y=0, n=0; x<na || y<nb;)
+        if(y == nb || (x < na && a[x] < b[y]))
+            out[n++] = a[x++];
+        else if(x == na || a[x] > b[y])
+            out[n++] = b[y++];
+        else
+        {
+            out[n++] = a[x++];
+            y++;
+        }
+    
+    return n;
+}
+
+int check_complete(struct rtkinput *input, unsigned int *found, unsigned int *single, unsigned int *tmp)
+{
+    struct rtkinput word;
+    int x, first, count, n, nr;
+    
+    // the kanji the scan finds for every word a prefix completes to,
+    // the index has to find them for the prefix too, short prefixes
+    // complete to the same words again so the scans are kept
+    count = rtk_vocab_complete(input->primitive, &first);
+    for(x=0, n=0; x<count; x++)
+    {
+        if(check_memo_count[first+x] == -1)
+        {
+            word.primitive = (char*)rtk_vocab_word(first+x);
+            nr = check_numbers(rtk_lookup_scan(1, &word), single);
+            check_memo[first+x] = malloc((nr ? nr : 1)*sizeof(unsigned int));
+            memcpy(check_memo[first+x], single, nr*sizeof(unsigned int));
+            check_memo_count[first+x] = nr;
+        }
+        n = check_or(found, n, check_memo[first+x], check_memo_count[first+x], tmp);
+        memcpy(found, tmp, n*sizeof(unsigned int));
+    }
+    
+    return n;
+}
+
+int check_subset(const unsigned int *a, int na, const unsigned int *b, int nb)
+{
+    int x;
+    
+    for(x=0; x<na && bsearch(&a[x], b, nb, sizeof(unsigned int), check_cmp); x++);
+    
+    return x == na;
+}
+
+void check_push(char ***words, int *count, const char *word)
+{
+    if(!(*count & (*count-1)))
+        *words = realloc(*words, (*count ? 2**count : 1)*sizeof(char*));
+    (*words)[(*count)++] = strdup(word);
+}
+
+int check_words(const char *file, char ***words, int *count, char ***special, int *specials)
+{
+    FILE *dict;
+    char *line, *field[6], *name;
+    int x, lines, skip, placeholder;
+    size_t n;
+    
+    // every name and primitive of the file as it is, for words the
+    // index lost, and the names the lookups treat apart, skipped ones,
+    // alternatives after a '-' placeholder, meanings of kanji without
+    // primitives and names of entries without kanji, each looked up
+    // as often as the vocabulary
+    *words = *special = 0;
+    *count = *specials = 0;
+    if(!(dict = fopen(file, "r")))
+        return 0;
+    
+    line = 0;
+    lines = 0;
+    while(getline(&line, &n, dict) != -1)
+    {
+        lines++;
+        if(*line == '#')
+            continue;
+        for(x=0; x<6 && (field[x] = strtok(x ? 0 : line, ":\n")); x++);
+        if(x < 6)
+            continue;
+        
+        skip = atoi(field[1]);
+        placeholder = 0;
+        for(x=0, name=field[3]; name; x++, name=strtok(x == 1 ? field[4] : 0, "/"))
+        {
+            if(name[0] == '-' && !name[1])
+            {
+                placeholder = 1;
+                continue;
+            }
+            check_push(words, count, name);
+            if(x < skip || placeholder || (!x && !strcmp(field[5], "-")) || !strcmp(field[2], "-"))
+                check_push(special, specials, name);
+        }
+        for(name=strtok(field[5], "/"); name; name=strtok(0, "/"))
+            if(name[0] != '-' || name[1])
+                check_push(words, count, name);
+    }
+    
+    free(line);
+    fclose(dict);
+    
+    return lines;
+}
+
+int check(const char *file, int queries)
+{
+    struct rtkstats st;
+    struct rtkinput input[CHECK_TERMS];
+    char terms[CHECK_TERMS][CHECK_LEN], keys[CHECK_TERMS][CHECK_LEN], **words, **special;
+    unsigned int *indexed, *scanned, *single, *common, *lower, *found, *tmp;
+    int q, x, y, n, ni, ns, nr, nc, nl, size, pick, tries, prefix, count, specials, mismatches, prefixed, ordered;
+    const char *word;
+    
+    if(rtk_lookup_init(1, &file) || rtk_lookup_stats(&st))
+        return 2;
+    
+    // the scan finds kanji of every line even if the index lost some
+    size = check_words(file, &words, &count, &special, &specials);
+    size = (size > st.entries ? size : st.entries)+1;
+    indexed = malloc(size*sizeof(unsigned int));
+    scanned = malloc(size*sizeof(unsigned int));
+    single = malloc(size*sizeof(unsigned int));
+    common = malloc(size*sizeof(unsigned int));
+    lower = malloc(size*sizeof(unsigned int));
+    found = malloc(size*sizeof(unsigned int));
+    tmp = malloc(size*sizeof(unsigned int));
+    check_memo = calloc(st.words ? st.words : 1, sizeof(unsigned int*));
+    check_memo_count = malloc((st.words ? st.words : 1)*sizeof(int));
+    memset(check_memo_count, -1, (st.words ? st.words : 1)*sizeof(int));
+    
+    // random queries of different keywords in the syntax both the
+    // index and the line scan understand must find the same kanji
+    for(q=0, mismatches=0, prefixed=0, ordered=0; (st.words || count) && q<queries; q++)
+    {
+        n = 1+check_rnd(CHECK_TERMS);
+        for(x=0; x<n; x++)
+        {
+            for(tries=0, y=0; !tries || (y < x && tries < CHECK_LEN); tries++)
+            {
+                pick = check_rnd(3);
+                if(specials && !pick)
+                    word = special[check_rnd(specials)];
+                else if(count && (!st.words || pick == 1))
+                    word = words[check_rnd(count)];
+                else
+                    word = rtk_vocab_word(check_rnd(st.words));
+                check_term(word, terms[x]);
+                check_key(terms[x], keys[x]);
+                for(y=0; y<x && !check_overlap(keys[y], keys[x]); y++);
+            }
+            if(y < x)
+                break;
+            input[x].primitive = terms[x];
+        }
+        n = x;
+        
+        ni = check_numbers(rtk_lookup(n, input), indexed);
+        ns = check_numbers(rtk_lookup_scan(n, input), scanned);
+        if(ni == ns && !memcmp(indexed, scanned, ni*sizeof(unsigned int)))
+            continue;
+        
+        // what the scan finds for every primitive on its own and,
+        // for prefixes, for every word they complete to
+        for(x=0, nc=0, nl=0, prefix=0; x<n; x++)
+        {
+            nr = check_numbers(rtk_lookup_scan(1, input+x), single);
+            if(x)
+                nc = check_and(common, nc, single, nr);
+            else
+                memcpy(common, single, (nc = nr)*sizeof(unsigned int));
+            
+            if(keys[x][strlen(keys[x])-1] != '*')
+                y = nr;
+            else
+            {
+                y = check_complete(input+x, found, single, tmp);
+                memcpy(single, found, y*sizeof(unsigned int));
+                prefix = 1;
+            }
+            
+            if(x)
+                nl = check_and(lower, nl, single, y);
+            else
+                memcpy(lower, single, (nl = y)*sizeof(unsigned int));
+        }
+        
+        // the documented differences of the scan, anything else is a
+        // mismatch:
+        // prefix, the scan matches the keywords it collected for a prefix
+        // as prefixes too and finds more than the index, which finds
+        // at least what the words the prefix completes to find
+        // term order, the scan passes the aliases of a line on to the
+        // first primitive naming it only, all primitives at once find
+        // less than the index and than every one on its own
+        if(prefix && check_subset(indexed, ni, common, nc)
+                && check_subset(lower, nl, indexed, ni))
+        {
+            prefixed++;
+            continue;
+        }
+        if(!prefix && n > 1 && ni == nc && !memcmp(indexed, common, ni*sizeof(unsigned int))
+                && check_subset(scanned, ns, indexed, ni))
+        {
+            ordered++;
+            continue;
+        }
+        
+        mismatches++;
+        printf("mismatch:");
+        for(x=0; x<n; x++)
+            printf(" '%s'", terms[x]);
+        printf(" index %i scan %i\n", ni, ns);
+        check_diff("index only", indexed, ni, scanned, ns);
+        check_diff("scan only", scanned, ns, indexed, ni);
+    }
+    
+    printf("%i queries, %i mismatches, %i differing by prefix, %i by term order\n",
+        q, mismatches, prefixed, ordered);
+    
+    for(x=0; x<count; x++)
+        free(words[x]);
+    for(x=0; x<specials; x++)
+        free(special[x]);
+    for(x=0; x<st.words; x++)
+        free(check_memo[x]);
+    free(check_memo);
+    free(check_memo_count);
+    free(words);
+    free(special);
+    free(indexed);
+    free(scanned);
+    free(single);
+    free(common);
+    free(lower);
+    free(found);
+    free(tmp);
+    rtk_lookup_free();
+    
+    return mismatches ? 1 : 0;
+}
+
+void explain(struct rtkresult *result, int argc, struct rtkinput *input)
+{
+    char path[DECOMPOSE_LEN];
+    int x;
+    
+    for(x=0; x<argc; x++)
+        if(rtk_lookup_explain(result->id, x, path, DECOMPOSE_LEN) > 0)
+            printf("  %s: %s\n", input[x].primitive, path);
+}
 
 int main(int argc, char *argv[])
 {
     struct rtkinput *input;
     struct rtkresult *result;
-    int x;
+    char decomposition[DECOMPOSE_LEN];
+    const char **files;
+    int x, id, count, layers = 1, paths = 0, scan = 0;
+    
+    // connect asks a running rtkd instead of loading the file
+    if(argc > 1 && !strcmp(argv[1], "--connect"))
+    {
+        if(argc > 3 && argv[2][0] == '/')
+            return connect_lookup(argv[2], argc-3, argv+3);
+        if(argc > 2)
+            return connect_lookup(0, argc-2, argv+2);
+    }
+    
+    if(argc == 3 && !strcmp(argv[1], "--memstats"))
+        return memstats(argv[2]);
+    if(argc == 3 && !strcmp(argv[1], "--stats"))
+        return stats(argv[2]);
+    
+    // check compares the index with the line scan
+    if(argc >= 3 && !strcmp(argv[1], "--check"))
+    {
+        if(argc == 3)
+            return check(argv[2], CHECK_QUERIES);
+        if(argc == 5)
+        {
+            check_seed = atoi(argv[3]) ? atoi(argv[3]) : 1;
+            return check(argv[2], atoi(argv[4]));
+        }
+    }
+    
+    // verbose shows the plan of the lookup,
+    // explain the path to every primitive of a result,
+    // scan looks up with the line scan instead of the index,
+    // layers go over the kanjifile in the given order
+    files = malloc(argc*sizeof(char*));
+    while(argc > 1 && (!strcmp(argv[1], "-v") || !strcmp(argv[1], "-e") || !strcmp(argv[1], "-s")
+        || (argc > 2 && !strcmp(argv[1], "-l"))))
+    {
+        if(argv[1][1] == 'l')
+        {
+            files[layers++] = argv[2];
+            argv[2] = argv[0];
+            argv += 2;
+            argc -= 2;
+            continue;
+        }
+        if(argv[1][1] == 'v')
+            rtk_verbose = 1;
+        else if(argv[1][1] == 's')
+            scan = 1;
+        else
+            paths = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
     
     if(argc < 3)
     {
-        fprintf(stderr, "Usage: %s <kanjifile> <primitive> [<primitive> ...]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-v] [-e] [-s] [-l <layer> ...] <kanjifile> <primitive> [<primitive> ...]\n", argv[0]);
+        fprintf(stderr, "       %s --connect [<socket>] <primitive> [<primitive> ...]\n", argv[0]);
+        fprintf(stderr, "       %s --memstats <kanjifile>\n", argv[0]);
+        fprintf(stderr, "       %s --stats <kanjifile>\n", argv[0]);
+        fprintf(stderr, "       %s --check <kanjifile> [<seed> <queries>]\n", argv[0]);
+        free(files);
         return 1;
     }
     
-    if(rtk_lookup_init(argv[1]))
+    files[0] = argv[1];
+    if(rtk_lookup_init(layers, files))
+    {
+        free(files);
         return 2;
+    }
     
     input = malloc((argc-2)*sizeof(struct rtkinput));
     for(x=0; x<argc-2; x++)
         input[x].primitive = argv[x+2];
     
-    result = rtk_lookup(argc-2, input);
+    // kanji given as primitives are decomposed as well
+    for(x=0; x<argc-2; x++)
+        if((id = rtk_kanji_find(argv[x+2])) != -1
+            && rtk_decompose(id, decomposition, DECOMPOSE_LEN) > 0)
+            printf("decomposition: %s = %s\n", argv[x+2], decomposition);
+    
+    result = scan ? rtk_lookup_scan(argc-2, input) : rtk_lookup(argc-2, input);
     
     if(result)
     {
+        for(count=0; result[count].kanji; count++);
+        rtk_lookup_rank(result, count, 0, count);
+        
         while(result->kanji)
         {
             printf("found: [%u] %s %s\n", result->number, result->kanji, result->meaning);
+            if(paths)
+                explain(result, argc-2, input);
             result++;
         }
     }
     else
+    {
         for(x=0; x<argc-2; x++)
             if(!input[x].found)
                 printf("not found: %s\n", input[x].primitive);
+        
+        // kanji containing only some of the primitives
+        if(argc-2 > 1 && (result = rtk_lookup_partial(argc-2, input)))
+        {
+            for(count=0; result[count].kanji; count++);
+            rtk_lookup_rank(result, count, 0, count);
+            
+            while(result->kanji)
+            {
+                printf("partial: [%u] %s %s (%i/%i)\n", result->number,
+                    result->kanji, result->meaning, result->partial, argc-2);
+                if(paths)
+                    explain(result, argc-2, input);
+                result++;
+            }
+        }
+    }
     
     free(input);
+    free(files);
     rtk_lookup_free();
     
     return 0;